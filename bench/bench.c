@@ -0,0 +1,395 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "bench.h"
+#include <mitosha.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * Allocator and container benchmark suite. Every case runs twice on a
+ * fresh setup: once untimed per operation for throughput, once timing each
+ * operation for p50/p99/p999 latency. Object counts sweep in powers of ten
+ * between --min_count and --max_count; cases needing more than
+ * --max_memory bytes are skipped.
+ */
+typedef struct {
+  bench_options_t common;
+  size_t min_count;
+  size_t max_count;
+  size_t max_memory;
+  int max_procs;
+} suite_options_t;
+
+static suite_options_t suite = {{NULL, NULL, 0, 1}, 1000, 1000000, (size_t) 2 << 30, 4};
+
+#define SUITE_RUNS 3 /* operations measured by one case */
+
+typedef struct {
+  size_t count;
+  size_t size; /* object size */
+  int frag;    /* percent of resident blocks freed before measuring */
+  int procs;
+} suite_case_t;
+
+typedef void (*suite_scenario_f)(suite_case_t const*, char const* const* names, bench_run_t* runs, int timed);
+
+static char* suite_memory(size_t size) {
+  char* mem = malloc(size);
+  if (mem)
+    memset(mem, 0, size); /* fault pages in outside of the measurement */
+  return mem;
+}
+
+static size_t* suite_order(size_t n, uint64_t* rnd) {
+  size_t* idx = malloc(n * sizeof(size_t));
+  for (size_t i = 0; i < n; ++i)
+    idx[i] = i;
+  bench_shuffle(idx, n, rnd);
+  return idx;
+}
+
+/*---------------------------------------------------------------------------*/
+/* mpool alloc/realloc/free */
+
+/* object sizes vary in [size/2, 3*size/2) so free blocks do not match exactly */
+static size_t pool_size_of(size_t size, uint64_t* rnd) {
+  return size / 2 + (size_t) (bench_rand(rnd) % size);
+}
+
+static size_t pool_memory(suite_case_t const* c) {
+  /* resident set plus measured blocks grown to twice their size */
+  return mpool_calc_required_size(3 * c->size, 2 * c->count);
+}
+
+static void pool_scenario(suite_case_t const* c, char const* const* names, bench_run_t* runs, int timed) {
+  size_t const n = c->count;
+  size_t const memsize = pool_memory(c);
+  char* mem = suite_memory(memsize);
+  mpool_t* pool = mem ? mpool_format_memory(mem, memsize) : NULL;
+  void** resident = malloc(n * sizeof(void*));
+  void** blocks = malloc(n * sizeof(void*));
+  size_t* sizes = malloc(n * sizeof(size_t));
+  if (!pool || !resident || !blocks || !sizes) {
+    fprintf(stderr, "%s out of memory\n", __func__);
+    exit(EXIT_FAILURE);
+  }
+  uint64_t rnd = suite.common.seed * 2654435761u + 1;
+
+  for (size_t i = 0; i < n; ++i)
+    resident[i] = mpool_alloc(pool, pool_size_of(c->size, &rnd));
+  size_t* order = suite_order(n, &rnd);
+  for (size_t i = 0; i < n * (size_t) c->frag / 100; ++i) {
+    mpool_free(pool, resident[order[i]]);
+    resident[order[i]] = NULL;
+  }
+  for (size_t i = 0; i < n; ++i)
+    sizes[i] = pool_size_of(c->size, &rnd);
+
+  bench_begin(&runs[0], names[0], n, timed);
+  for (size_t i = 0; i < n; ++i)
+    BENCH_OP(&runs[0], blocks[i] = mpool_alloc(pool, sizes[i]));
+  bench_end(&runs[0]);
+
+  bench_shuffle(order, n, &rnd);
+  bench_begin(&runs[1], names[1], n, timed);
+  for (size_t i = 0; i < n; ++i) {
+    size_t const k = order[i];
+    void* moved;
+    BENCH_OP(&runs[1], moved = mpool_realloc(pool, blocks[k], 2 * sizes[k]));
+    if (moved)
+      blocks[k] = moved;
+  }
+  bench_end(&runs[1]);
+
+  bench_shuffle(order, n, &rnd);
+  bench_begin(&runs[2], names[2], n, timed);
+  for (size_t i = 0; i < n; ++i)
+    BENCH_OP(&runs[2], mpool_free(pool, blocks[order[i]]));
+  bench_end(&runs[2]);
+
+  free(order);
+  free(sizes);
+  free(blocks);
+  free(resident);
+  free(mem);
+}
+
+/*---------------------------------------------------------------------------*/
+/* avltree insert/lookup/remove */
+
+typedef struct {
+  avlnode_t avl;
+  uint64_t key;
+} suite_avl_t;
+
+static int suite_avl_cmp(avlnode_t const* l, avlnode_t const* r) {
+  uint64_t const a = mcontainer_of(l, suite_avl_t, avl)->key;
+  uint64_t const b = mcontainer_of(r, suite_avl_t, avl)->key;
+  return (a > b) - (a < b);
+}
+
+static size_t avl_memory(suite_case_t const* c) {
+  return c->count * (sizeof(suite_avl_t) + sizeof(size_t));
+}
+
+static void avl_scenario(suite_case_t const* c, char const* const* names, bench_run_t* runs, int timed) {
+  size_t const n = c->count;
+  suite_avl_t* nodes = (suite_avl_t*) suite_memory(n * sizeof(suite_avl_t));
+  uint64_t rnd = suite.common.seed * 2654435761u + 2;
+  size_t* order = suite_order(n, &rnd);
+  avltree_t tree;
+  avltree_init(&tree);
+  for (size_t i = 0; i < n; ++i)
+    nodes[i].key = i * 2654435761u;
+
+  bench_begin(&runs[0], names[0], n, timed);
+  for (size_t i = 0; i < n; ++i)
+    BENCH_OP(&runs[0], avltree_insert(&nodes[order[i]].avl, suite_avl_cmp, &tree));
+  bench_end(&runs[0]);
+
+  bench_shuffle(order, n, &rnd);
+  size_t found = 0;
+  bench_begin(&runs[1], names[1], n, timed);
+  for (size_t i = 0; i < n; ++i)
+    BENCH_OP(&runs[1], found += !!avltree_lookup(&nodes[order[i]].avl, suite_avl_cmp, &tree));
+  bench_end(&runs[1]);
+  if (found != n)
+    fprintf(stderr, "%s lookup found %zu of %zu\n", __func__, found, n);
+
+  bench_shuffle(order, n, &rnd);
+  bench_begin(&runs[2], names[2], n, timed);
+  for (size_t i = 0; i < n; ++i)
+    BENCH_OP(&runs[2], avltree_remove(&nodes[order[i]].avl, &tree));
+  bench_end(&runs[2]);
+
+  free(order);
+  free(nodes);
+}
+
+/*---------------------------------------------------------------------------*/
+/* list push/iterate/remove */
+
+typedef struct {
+  listnode_t link;
+  uint64_t value;
+} suite_list_t;
+
+static size_t list_memory(suite_case_t const* c) {
+  return c->count * (sizeof(suite_list_t) + sizeof(size_t));
+}
+
+static void list_scenario(suite_case_t const* c, char const* const* names, bench_run_t* runs, int timed) {
+  size_t const n = c->count;
+  suite_list_t* nodes = (suite_list_t*) suite_memory(n * sizeof(suite_list_t));
+  uint64_t rnd = suite.common.seed * 2654435761u + 3;
+  size_t* order = suite_order(n, &rnd);
+  list_t list;
+  list_init(&list);
+
+  bench_begin(&runs[0], names[0], n, timed);
+  for (size_t i = 0; i < n; ++i)
+    BENCH_OP(&runs[0], list_push_back(&nodes[order[i]].link, &list));
+  bench_end(&runs[0]);
+
+  /* nodes were linked in random order: iteration chases pointers */
+  uint64_t sum = 0;
+  listnode_t* node = list_front(&list);
+  bench_begin(&runs[1], names[1], n, timed);
+  for (size_t i = 0; i < n; ++i)
+    BENCH_OP(&runs[1], sum += mcontainer_of(node, suite_list_t, link)->value; node = list_next(node));
+  bench_end(&runs[1]);
+  if (sum)
+    fprintf(stderr, "%s unexpected sum\n", __func__);
+
+  bench_shuffle(order, n, &rnd);
+  bench_begin(&runs[2], names[2], n, timed);
+  for (size_t i = 0; i < n; ++i)
+    BENCH_OP(&runs[2], list_remove(&nodes[order[i]].link, &list));
+  bench_end(&runs[2]);
+
+  free(order);
+  free(nodes);
+}
+
+/*---------------------------------------------------------------------------*/
+/* mshm_lock across processes */
+
+#define LOCK_NAME "mitosha_bench"
+#define LOCK_OPS_MAX 1000000 /* lock/unlock pairs per process */
+
+static size_t lock_ops(suite_case_t const* c) {
+  return c->count < LOCK_OPS_MAX ? c->count : LOCK_OPS_MAX;
+}
+
+static size_t lock_memory(suite_case_t const* c) {
+  return sizeof(uint64_t) * (2 + (size_t) c->procs * (BENCH_SAMPLES_MAX / c->procs + 1));
+}
+
+static void lock_scenario(suite_case_t const* c, char const* const* names, bench_run_t* runs, int timed) {
+  size_t const ops = lock_ops(c);
+  size_t const per_proc = BENCH_SAMPLES_MAX / c->procs;
+
+  /* layout: counter, per process sample count and samples */
+  mshm_unlink(LOCK_NAME);
+  mshm_t* shm = mshm_create(LOCK_NAME, lock_memory(c));
+  if (!shm) {
+    fprintf(stderr, "%s cannot create segment\n", __func__);
+    exit(EXIT_FAILURE);
+  }
+  uint64_t* counter = mshm_memory_ptr(shm);
+  memset(counter, 0, lock_memory(c));
+
+  bench_begin(&runs[0], names[0], ops * c->procs, 0);
+
+  pid_t pids[64];
+  for (int p = 0; p < c->procs; ++p) {
+    if ((pids[p] = fork()))
+      continue;
+    uint64_t* samples = counter + 1 + (size_t) p * (per_proc + 1);
+    bench_lat_t lat = {timed ? samples + 1 : NULL, 0, (ops + per_proc - 1) / per_proc, 0};
+    bench_run_t child = {.lat = lat};
+    for (size_t i = 0; i < ops; ++i)
+      BENCH_OP(&child, mshm_lock(shm); ++*counter; mshm_unlock(shm));
+    samples[0] = child.lat.n < per_proc ? child.lat.n : per_proc;
+    _exit(0);
+  }
+  for (int p = 0; p < c->procs; ++p)
+    waitpid(pids[p], NULL, 0);
+  bench_end(&runs[0]);
+  runs[0].cpu_ns = 0; /* spent in the children */
+
+  if (*counter != ops * c->procs)
+    fprintf(stderr, "%s counter %llu, expected %zu\n", __func__, (unsigned long long) *counter, ops * c->procs);
+  for (int p = 0; timed && p < c->procs; ++p) {
+    uint64_t const* samples = counter + 1 + (size_t) p * (per_proc + 1);
+    bench_lat_merge(&runs[0].lat, samples + 1, samples[0]);
+  }
+
+  mshm_cleanup(shm);
+  mshm_unlink(LOCK_NAME);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* scenario with its measured operations (NULL when unused) */
+typedef struct {
+  suite_scenario_f run;
+  size_t (*memory)(suite_case_t const*);
+  int (*params)(suite_case_t const*, char*, size_t);
+  char const* ops[SUITE_RUNS];
+} suite_family_t;
+
+static int pool_params(suite_case_t const* c, char* buf, size_t size) {
+  return snprintf(buf, size, "size:%zu/count:%zu/frag:%d", c->size, c->count, c->frag);
+}
+
+static int count_params(suite_case_t const* c, char* buf, size_t size) {
+  return snprintf(buf, size, "count:%zu", c->count);
+}
+
+static int lock_params(suite_case_t const* c, char* buf, size_t size) {
+  return snprintf(buf, size, "procs:%d/count:%zu", c->procs, lock_ops(c));
+}
+
+static suite_family_t const pool_family = {pool_scenario, pool_memory, pool_params,
+                                           {"mpool_alloc", "mpool_realloc", "mpool_free"}};
+static suite_family_t const avl_family = {avl_scenario, avl_memory, count_params,
+                                          {"avltree_insert", "avltree_lookup", "avltree_remove"}};
+static suite_family_t const list_family = {list_scenario, list_memory, count_params,
+                                           {"list_push_back", "list_iterate", "list_remove"}};
+static suite_family_t const lock_family = {lock_scenario, lock_memory, lock_params, {"mshm_lock", NULL, NULL}};
+
+static void suite_run(suite_family_t const* family, suite_case_t const* c) {
+  char params[BENCH_NAME_MAX / 2], names[SUITE_RUNS][BENCH_NAME_MAX];
+  char const* name_ptrs[SUITE_RUNS];
+  int wanted = 0;
+  family->params(c, params, sizeof(params));
+  for (int i = 0; i < SUITE_RUNS && family->ops[i]; ++i) {
+    snprintf(names[i], sizeof(names[i]), "%s/%s", family->ops[i], params);
+    name_ptrs[i] = names[i];
+    wanted |= bench_match(&suite.common, names[i]);
+  }
+  if (!wanted)
+    return;
+  size_t const memory = family->memory(c);
+  if (memory > suite.max_memory) {
+    fprintf(stderr, "skip %s/%s: needs %zu bytes (--max_memory)\n", family->ops[0], params, memory);
+    return;
+  }
+
+  bench_run_t tp[SUITE_RUNS], lat[SUITE_RUNS];
+  memset(tp, 0, sizeof(tp));
+  memset(lat, 0, sizeof(lat));
+  family->run(c, name_ptrs, tp, 0);
+  family->run(c, name_ptrs, lat, 1);
+  for (int i = 0; i < SUITE_RUNS; ++i) {
+    if (tp[i].ops && bench_match(&suite.common, tp[i].name))
+      bench_report(&tp[i], &lat[i], NULL);
+    bench_run_free(&tp[i]);
+    bench_run_free(&lat[i]);
+  }
+}
+
+static void suite_usage(char const* exe) {
+  printf("usage: %s [options]\n"
+         "  --benchmark_filter=<substring>   run benchmarks whose name contains it\n"
+         "  --benchmark_format=console|json  json: JSON on stdout, table on stderr\n"
+         "  --benchmark_out=<file>           write JSON to file\n"
+         "  --seed=<n>                       random seed (default 1)\n"
+         "  --min_count=<n>                  smallest object count (default 1000)\n"
+         "  --max_count=<n>                  largest object count (default 1000000, up to 1e8)\n"
+         "  --max_memory=<bytes>             skip cases needing more memory (default 2 GiB)\n"
+         "  --max_procs=<n>                  largest process count for mshm_lock (default 4)\n",
+         exe);
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    char const* arg = argv[i];
+    if (bench_parse_option(&suite.common, arg))
+      continue;
+    if (!strncmp(arg, "--min_count=", 12))
+      suite.min_count = (size_t) strtod(arg + 12, NULL);
+    else if (!strncmp(arg, "--max_count=", 12))
+      suite.max_count = (size_t) strtod(arg + 12, NULL);
+    else if (!strncmp(arg, "--max_memory=", 13))
+      suite.max_memory = (size_t) strtod(arg + 13, NULL);
+    else if (!strncmp(arg, "--max_procs=", 12))
+      suite.max_procs = atoi(arg + 12);
+    else {
+      suite_usage(argv[0]);
+      return strcmp(arg, "--help") ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+  }
+  if (suite.max_procs < 1 || suite.max_procs > 64 || !suite.min_count) {
+    suite_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  static size_t const sizes[] = {16, 64, 256, 1024};
+  static int const frags[] = {25, 50, 75};
+
+  bench_report_open(&suite.common, argv[0]);
+  for (size_t count = suite.min_count; count <= suite.max_count; count *= 10) {
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+      suite_case_t const c = {count, sizes[i], 0, 1};
+      suite_run(&pool_family, &c);
+    }
+    for (size_t i = 0; i < sizeof(frags) / sizeof(frags[0]); ++i) {
+      suite_case_t const c = {count, 64, frags[i], 1};
+      suite_run(&pool_family, &c);
+    }
+    suite_case_t const c = {count, 0, 0, 1};
+    suite_run(&avl_family, &c);
+    suite_run(&list_family, &c);
+    for (int procs = 1; procs <= suite.max_procs; procs *= 2) {
+      suite_case_t const l = {count, 0, 0, procs};
+      suite_run(&lock_family, &l);
+    }
+  }
+  bench_report_close();
+  return EXIT_SUCCESS;
+}
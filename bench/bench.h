@@ -0,0 +1,114 @@
+#ifndef MITOSHA_BENCH_H
+#define MITOSHA_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Benchmark helpers: monotonic timer, sampled latencies with percentiles
+ * and a reporter printing a console table and/or Google Benchmark style
+ * JSON (context + benchmarks array, times in ns).
+ */
+
+#define BENCH_NAME_MAX 160
+#define BENCH_SAMPLES_MAX (1u << 20) /* latency samples kept per run */
+
+/* per-op latencies, every stride-th op kept */
+typedef struct {
+  uint64_t* ns;
+  size_t n;
+  size_t stride;
+  size_t tick;
+} bench_lat_t;
+
+/* one measured run */
+typedef struct {
+  char name[BENCH_NAME_MAX];
+  size_t ops;
+  uint64_t real_ns;
+  uint64_t cpu_ns;
+  uint64_t start_real;
+  uint64_t start_cpu;
+  bench_lat_t lat;
+} bench_run_t;
+
+/* percentiles of a latency run */
+typedef struct {
+  double p50;
+  double p99;
+  double p999;
+  double max;
+} bench_pct_t;
+
+/* Monotonic wall clock and process CPU time in ns */
+uint64_t bench_now(void);
+uint64_t bench_cpu_now(void);
+
+/* Minimal cost of a bench_now pair, subtracted from latency samples */
+uint64_t bench_timer_overhead(void);
+
+/* Prepare run for ops operations (timed: keep latency samples) */
+void bench_begin(bench_run_t*, char const* name, size_t ops, int timed);
+void bench_end(bench_run_t*);
+void bench_run_free(bench_run_t*);
+
+static inline void bench_lat_add(bench_lat_t* lat, uint64_t ns) {
+  if (lat->ns && lat->tick++ % lat->stride == 0 && lat->n < BENCH_SAMPLES_MAX)
+    lat->ns[lat->n++] = ns;
+}
+
+/* Run stmt, timing it when the run keeps latencies */
+#define BENCH_OP(run, stmt)                                                                                            \
+  do {                                                                                                                 \
+    if ((run)->lat.ns) {                                                                                               \
+      uint64_t const bench_t0_ = bench_now();                                                                          \
+      stmt;                                                                                                            \
+      bench_lat_add(&(run)->lat, bench_now() - bench_t0_);                                                             \
+    } else {                                                                                                           \
+      stmt;                                                                                                            \
+    }                                                                                                                  \
+  } while (0)
+
+/* Sort samples and compute percentiles (timer overhead removed) */
+bench_pct_t bench_percentiles(bench_lat_t*);
+
+/* Append n samples to dst (e.g. collected by other processes) */
+void bench_lat_merge(bench_lat_t* dst, uint64_t const* ns, size_t n);
+
+/* common command line options */
+typedef struct {
+  char const* filter;
+  char const* out;
+  int json; /* --benchmark_format=json on stdout */
+  unsigned long seed;
+} bench_options_t;
+
+/* Parse one --benchmark_* or --seed flag; return 1 when recognised */
+int bench_parse_option(bench_options_t*, char const* arg);
+
+/* Return non-zero when name passes --benchmark_filter (substring) */
+int bench_match(bench_options_t const*, char const* name);
+
+/*
+ * Reporter: bench_report_open writes the context, bench_report adds a
+ * result (throughput from tp, latency from lat, either may be NULL),
+ * bench_report_close ends the JSON document.
+ */
+void bench_report_open(bench_options_t const*, char const* executable);
+void bench_report(bench_run_t const* tp, bench_run_t* lat, char const* counters);
+void bench_report_close(void);
+
+/* Deterministic xorshift generator */
+static inline uint64_t bench_rand(uint64_t* state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/* Fisher-Yates shuffle of n indices */
+void bench_shuffle(size_t*, size_t n, uint64_t* state);
+
+#endif /* MITOSHA_BENCH_H */
@@ -0,0 +1,308 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "bench.h"
+#include <mitosha.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/*
+ * Multi-process contention benchmark: N forked processes attach one
+ * segment by name (as in tests/test_shm.c) and run a mixed workload on a
+ * shared mpool_t plus an avltree_t index under the segment lock:
+ *
+ *   alloc:  lock, mpool_alloc + avltree_insert, unlock
+ *   free:   lock, avltree_remove + mpool_free, unlock
+ *   lookup: lock (read lock with --lock=rw), avltree_lookup, unlock
+ *
+ * Every operation is timed from the lock request, the time until the lock
+ * is granted is accounted as lock wait. Reported per process count:
+ * aggregate throughput, lock wait share and p50/p99/p999 latency, then the
+ * tail latency of each process.
+ */
+#define MP_NAME "mitosha_bench_mp"
+#define MP_PROCS_MAX 64
+
+enum { MP_LOCK_SEM, MP_LOCK_MUTEX, MP_LOCK_RW };
+static char const* const mp_lock_names[] = {"sem", "mutex", "rw"};
+
+typedef struct {
+  bench_options_t common;
+  int max_procs;
+  size_t ops;  /* operations per process */
+  size_t live; /* objects a process keeps at most */
+  size_t size_min;
+  size_t size_max;
+  int mix_alloc; /* percent of operations */
+  int mix_free;
+  int lock;
+} mp_options_t;
+
+static mp_options_t mp = {{NULL, NULL, 0, 1}, 4, 200000, 1000, 16, 256, 40, 40, MP_LOCK_SEM};
+
+typedef struct {
+  avlnode_t avl;
+  uint64_t key;
+} mp_object_t;
+
+/* per process results, in an anonymous shared mapping */
+typedef struct {
+  uint64_t ops;
+  uint64_t wait_ns;
+  uint64_t real_ns;
+  uint64_t failed; /* allocations failed (pool full) */
+  size_t samples;
+} mp_result_t;
+
+typedef struct {
+  mevent_t start;
+  uint32_t ready;
+  uint32_t go;
+  size_t tree; /* offset of the index in the segment */
+  mp_result_t result[MP_PROCS_MAX];
+} mp_control_t;
+
+static int mp_cmp(avlnode_t const* l, avlnode_t const* r) {
+  uint64_t const a = mcontainer_of(l, mp_object_t, avl)->key;
+  uint64_t const b = mcontainer_of(r, mp_object_t, avl)->key;
+  return (a > b) - (a < b);
+}
+
+static size_t mp_segment_size(int procs) {
+  return mpool_calc_required_size(sizeof(mp_object_t) + mp.size_max, 2 * mp.live * (size_t) procs) +
+         mpool_calc_required_size(sizeof(avltree_t), 1);
+}
+
+static inline void mp_lock(mshm_t* shm, int shared) {
+  if (mp.lock == MP_LOCK_RW)
+    shared ? mshm_rdlock(shm) : mshm_wrlock(shm);
+  else
+    mshm_lock(shm);
+}
+
+static inline void mp_unlock(mshm_t* shm) {
+  if (mp.lock == MP_LOCK_RW)
+    mshm_rwunlock(shm);
+  else
+    mshm_unlock(shm);
+}
+
+static void mp_child(int id, mp_control_t* ctl, uint64_t* samples, size_t max_samples) {
+  mshm_t* shm = mshm_open(MP_NAME);
+  mpool_t* pool = shm ? mpool_attach_existing(mshm_memory_ptr(shm)) : NULL;
+  if (!pool)
+    _exit(1);
+  avltree_t* tree = (avltree_t*) ((char*) mshm_memory_ptr(shm) + ctl->tree);
+  uint64_t* keys = malloc(mp.live * sizeof(uint64_t));
+  size_t live = 0;
+  uint64_t seq = 0, rnd = mp.common.seed * 2654435761u + (uint64_t) id + 1;
+
+  __atomic_add_fetch(&ctl->ready, 1, __ATOMIC_RELEASE);
+  for (;;) {
+    uint32_t const seq_ev = mevent_seq(&ctl->start);
+    if (__atomic_load_n(&ctl->go, __ATOMIC_ACQUIRE))
+      break;
+    mevent_wait(&ctl->start, seq_ev, -1);
+  }
+
+  mp_result_t* res = &ctl->result[id];
+  size_t const stride = (mp.ops + max_samples - 1) / max_samples;
+  uint64_t const begin = bench_now();
+  for (size_t i = 0; i < mp.ops; ++i) {
+    int const r = (int) (bench_rand(&rnd) % 100);
+    int const op = (r < mp.mix_alloc || !live) && live < mp.live ? 0 : r < mp.mix_alloc + mp.mix_free ? 1 : 2;
+    uint64_t const t0 = bench_now();
+    mp_lock(shm, op == 2);
+    uint64_t const t1 = bench_now();
+    if (op == 0) {
+      size_t const size = mp.size_min + (size_t) (bench_rand(&rnd) % (mp.size_max - mp.size_min + 1));
+      mp_object_t* obj = mpool_alloc(pool, sizeof(mp_object_t) + size);
+      if (obj) {
+        obj->key = (uint64_t) id << 48 | seq++;
+        avltree_insert(&obj->avl, mp_cmp, tree);
+        keys[live++] = obj->key;
+      } else {
+        ++res->failed;
+      }
+    } else {
+      size_t const k = (size_t) (bench_rand(&rnd) % live);
+      mp_object_t key;
+      key.key = keys[k];
+      avlnode_t* node = avltree_lookup(&key.avl, mp_cmp, tree);
+      if (op == 1 && node) {
+        avltree_remove(node, tree);
+        mpool_free(pool, mcontainer_of(node, mp_object_t, avl));
+        keys[k] = keys[--live];
+      }
+    }
+    mp_unlock(shm);
+    uint64_t const t2 = bench_now();
+    res->wait_ns += t1 - t0;
+    if (i % stride == 0 && res->samples < max_samples)
+      samples[res->samples++] = t2 - t0;
+  }
+  res->real_ns = bench_now() - begin;
+  res->ops = mp.ops;
+
+  /* leave the pool as found for the next round */
+  mp_lock(shm, 0);
+  for (size_t k = 0; k < live; ++k) {
+    mp_object_t key;
+    key.key = keys[k];
+    avlnode_t* node = avltree_lookup(&key.avl, mp_cmp, tree);
+    if (node) {
+      avltree_remove(node, tree);
+      mpool_free(pool, mcontainer_of(node, mp_object_t, avl));
+    }
+  }
+  mp_unlock(shm);
+  free(keys);
+  mshm_cleanup(shm);
+  _exit(0);
+}
+
+static void mp_round(int procs) {
+  size_t const max_samples = BENCH_SAMPLES_MAX / (size_t) procs;
+  size_t const ctl_size = sizeof(mp_control_t) + (size_t) procs * max_samples * sizeof(uint64_t);
+  mp_control_t* ctl = mmap(NULL, ctl_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (ctl == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t* samples = (uint64_t*) (ctl + 1);
+
+  mshm_unlink(MP_NAME);
+  mshm_options_t opts = {mp.lock == MP_LOCK_MUTEX ? MSHM_MUTEX : 0, MSHM_NUMA_DEFAULT, 0};
+  mshm_t* shm = mshm_create_ex(MP_NAME, mp_segment_size(procs), &opts);
+  mpool_t* pool = shm ? mpool_format_memory(mshm_memory_ptr(shm), mshm_memory_size(shm)) : NULL;
+  avltree_t* tree = pool ? mpool_alloc(pool, sizeof(avltree_t)) : NULL;
+  if (!tree) {
+    fprintf(stderr, "%s cannot set up segment\n", __func__);
+    exit(EXIT_FAILURE);
+  }
+  avltree_init(tree);
+  ctl->tree = (size_t) ((char*) tree - (char*) mshm_memory_ptr(shm));
+  size_t const used = mpool_used(pool);
+
+  pid_t pids[MP_PROCS_MAX];
+  for (int p = 0; p < procs; ++p)
+    if (!(pids[p] = fork()))
+      mp_child(p, ctl, samples + (size_t) p * max_samples, max_samples);
+
+  while (__atomic_load_n(&ctl->ready, __ATOMIC_ACQUIRE) < (uint32_t) procs)
+    usleep(1000);
+  bench_run_t run, lat;
+  char name[BENCH_NAME_MAX - 16];
+  snprintf(name, sizeof(name), "mpool_shared/lock:%s/procs:%d", mp_lock_names[mp.lock], procs);
+  bench_begin(&run, name, mp.ops * (size_t) procs, 0);
+  __atomic_store_n(&ctl->go, 1, __ATOMIC_RELEASE);
+  mevent_notify_all(&ctl->start);
+
+  int failed = 0;
+  for (int p = 0; p < procs; ++p) {
+    int status = 0;
+    waitpid(pids[p], &status, 0);
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+  }
+  bench_end(&run);
+  run.cpu_ns = 0; /* spent in the children */
+  if (failed)
+    fprintf(stderr, "%s a process failed\n", __func__);
+  if (mpool_used(pool) != used)
+    fprintf(stderr, "%s pool not empty after the round\n", __func__);
+
+  /* aggregate */
+  uint64_t wait = 0, busy = 0, nfailed = 0;
+  memset(&lat, 0, sizeof(lat));
+  for (int p = 0; p < procs; ++p) {
+    wait += ctl->result[p].wait_ns;
+    busy += ctl->result[p].real_ns;
+    nfailed += ctl->result[p].failed;
+    bench_lat_merge(&lat.lat, samples + (size_t) p * max_samples, ctl->result[p].samples);
+  }
+  char counters[256];
+  snprintf(counters, sizeof(counters),
+           "\"lock_wait_ns\": %llu, \"lock_wait_ratio\": %.4f, \"alloc_failed\": %llu, \"processes\": %d",
+           (unsigned long long) wait, busy ? (double) wait / (double) busy : 0.0, (unsigned long long) nfailed, procs);
+  bench_report(&run, &lat, counters);
+  fprintf(stderr, "  lock wait %.1f%% of process time\n", busy ? 100.0 * (double) wait / (double) busy : 0.0);
+  bench_run_free(&lat);
+
+  /* per process tail latency */
+  for (int p = 0; p < procs; ++p) {
+    mp_result_t const* res = &ctl->result[p];
+    bench_run_t one;
+    memset(&one, 0, sizeof(one));
+    snprintf(one.name, sizeof(one.name), "%s/proc:%d", name, p);
+    one.ops = res->ops;
+    one.real_ns = res->real_ns;
+    bench_lat_merge(&one.lat, samples + (size_t) p * max_samples, res->samples);
+    snprintf(counters, sizeof(counters), "\"lock_wait_ns\": %llu, \"lock_wait_ratio\": %.4f",
+             (unsigned long long) res->wait_ns, res->real_ns ? (double) res->wait_ns / (double) res->real_ns : 0.0);
+    bench_report(NULL, &one, counters);
+    bench_run_free(&one);
+  }
+
+  mshm_cleanup(shm);
+  mshm_unlink(MP_NAME);
+  munmap(ctl, ctl_size);
+}
+
+static void mp_usage(char const* exe) {
+  printf("usage: %s [options]\n"
+         "  --benchmark_format=console|json  json: JSON on stdout, table on stderr\n"
+         "  --benchmark_out=<file>           write JSON to file\n"
+         "  --seed=<n>                       random seed (default 1)\n"
+         "  --max_procs=<n>                  run 1, 2, 4 ... n processes (default 4)\n"
+         "  --ops=<n>                        operations per process (default 200000)\n"
+         "  --live=<n>                       objects a process keeps at most (default 1000)\n"
+         "  --size=<min>-<max>               object payload size (default 16-256)\n"
+         "  --mix=<alloc>:<free>             percent of alloc and free, rest lookup (default 40:40)\n"
+         "  --lock=sem|mutex|rw              mshm_lock with semaphore, MSHM_MUTEX, or rwlock (default sem)\n",
+         exe);
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    char const* arg = argv[i];
+    int ok = 1;
+    if (bench_parse_option(&mp.common, arg))
+      continue;
+    if (!strncmp(arg, "--max_procs=", 12))
+      mp.max_procs = atoi(arg + 12);
+    else if (!strncmp(arg, "--ops=", 6))
+      mp.ops = (size_t) strtod(arg + 6, NULL);
+    else if (!strncmp(arg, "--live=", 7))
+      mp.live = (size_t) strtod(arg + 7, NULL);
+    else if (!strncmp(arg, "--size=", 7))
+      ok = sscanf(arg + 7, "%zu-%zu", &mp.size_min, &mp.size_max) == 2;
+    else if (!strncmp(arg, "--mix=", 6))
+      ok = sscanf(arg + 6, "%d:%d", &mp.mix_alloc, &mp.mix_free) == 2;
+    else if (!strcmp(arg, "--lock=sem"))
+      mp.lock = MP_LOCK_SEM;
+    else if (!strcmp(arg, "--lock=mutex"))
+      mp.lock = MP_LOCK_MUTEX;
+    else if (!strcmp(arg, "--lock=rw"))
+      mp.lock = MP_LOCK_RW;
+    else
+      ok = 0;
+    if (!ok) {
+      mp_usage(argv[0]);
+      return strcmp(arg, "--help") ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+  }
+  if (mp.max_procs < 1 || mp.max_procs > MP_PROCS_MAX || !mp.ops || !mp.live || mp.size_min > mp.size_max ||
+      mp.mix_alloc < 0 || mp.mix_free < 0 || mp.mix_alloc + mp.mix_free > 100) {
+    mp_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  bench_report_open(&mp.common, argv[0]);
+  for (int procs = 1; procs <= mp.max_procs; procs *= 2)
+    mp_round(procs);
+  bench_report_close();
+  return EXIT_SUCCESS;
+}
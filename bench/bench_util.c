@@ -0,0 +1,214 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static FILE* report_json;   /* JSON destination, NULL when none */
+static FILE* report_table;  /* console table destination, NULL when none */
+static int report_count;    /* benchmarks written to JSON */
+static uint64_t report_overhead;
+
+uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t bench_cpu_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t bench_timer_overhead(void) {
+  static uint64_t overhead = UINT64_MAX;
+  if (overhead == UINT64_MAX) {
+    for (int i = 0; i < 10000; ++i) {
+      uint64_t const t0 = bench_now();
+      uint64_t const d = bench_now() - t0;
+      if (d < overhead)
+        overhead = d;
+    }
+  }
+  return overhead;
+}
+
+void bench_begin(bench_run_t* run, char const* name, size_t ops, int timed) {
+  memset(run, 0, sizeof(*run));
+  snprintf(run->name, sizeof(run->name), "%s", name);
+  run->ops = ops;
+  if (timed && ops) {
+    size_t const stride = (ops + BENCH_SAMPLES_MAX - 1) / BENCH_SAMPLES_MAX;
+    run->lat.stride = stride;
+    run->lat.ns = malloc((ops / stride + 1) * sizeof(uint64_t));
+  }
+  run->start_cpu = bench_cpu_now();
+  run->start_real = bench_now();
+}
+
+void bench_end(bench_run_t* run) {
+  run->real_ns = bench_now() - run->start_real;
+  run->cpu_ns = bench_cpu_now() - run->start_cpu;
+}
+
+void bench_run_free(bench_run_t* run) {
+  free(run->lat.ns);
+  run->lat.ns = NULL;
+  run->lat.n = 0;
+}
+
+static int bench_cmp_u64(void const* l, void const* r) {
+  uint64_t const a = *(uint64_t const*) l, b = *(uint64_t const*) r;
+  return (a > b) - (a < b);
+}
+
+static double bench_pick(bench_lat_t const* lat, double q) {
+  size_t const i = (size_t) (q * (double) (lat->n - 1) + 0.5);
+  uint64_t const v = lat->ns[i];
+  return v > report_overhead ? (double) (v - report_overhead) : 0.0;
+}
+
+bench_pct_t bench_percentiles(bench_lat_t* lat) {
+  bench_pct_t pct = {0, 0, 0, 0};
+  if (!lat->n)
+    return pct;
+  report_overhead = bench_timer_overhead();
+  qsort(lat->ns, lat->n, sizeof(uint64_t), bench_cmp_u64);
+  pct.p50 = bench_pick(lat, 0.5);
+  pct.p99 = bench_pick(lat, 0.99);
+  pct.p999 = bench_pick(lat, 0.999);
+  pct.max = bench_pick(lat, 1.0);
+  return pct;
+}
+
+void bench_lat_merge(bench_lat_t* dst, uint64_t const* ns, size_t n) {
+  uint64_t* merged = realloc(dst->ns, (dst->n + n) * sizeof(uint64_t));
+  if (!merged)
+    return;
+  memcpy(merged + dst->n, ns, n * sizeof(uint64_t));
+  dst->ns = merged;
+  dst->n += n;
+}
+
+void bench_shuffle(size_t* idx, size_t n, uint64_t* state) {
+  for (size_t i = n; i > 1; --i) {
+    size_t const j = (size_t) (bench_rand(state) % i);
+    size_t const t = idx[i - 1];
+    idx[i - 1] = idx[j];
+    idx[j] = t;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* options */
+
+int bench_parse_option(bench_options_t* opts, char const* arg) {
+  if (!strncmp(arg, "--benchmark_filter=", 19))
+    opts->filter = arg + 19;
+  else if (!strncmp(arg, "--benchmark_out=", 16))
+    opts->out = arg + 16;
+  else if (!strcmp(arg, "--benchmark_format=json"))
+    opts->json = 1;
+  else if (!strcmp(arg, "--benchmark_format=console"))
+    opts->json = 0;
+  else if (!strncmp(arg, "--seed=", 7))
+    opts->seed = strtoul(arg + 7, NULL, 0);
+  else
+    return 0;
+  return 1;
+}
+
+int bench_match(bench_options_t const* opts, char const* name) {
+  return !opts->filter || !*opts->filter || strstr(name, opts->filter);
+}
+
+/*---------------------------------------------------------------------------*/
+/* reporter */
+
+static void bench_json_string(FILE* out, char const* s) {
+  fputc('"', out);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', out);
+    fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+void bench_report_open(bench_options_t const* opts, char const* executable) {
+  report_json = opts->out ? fopen(opts->out, "w") : opts->json ? stdout : NULL;
+  if (opts->out && !report_json)
+    fprintf(stderr, "%s cannot write %s\n", __func__, opts->out);
+  report_table = opts->json && !opts->out ? stderr : stdout;
+  report_count = 0;
+
+  char date[64] = "", host[256] = "";
+  time_t const now = time(NULL);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+  gethostname(host, sizeof(host) - 1);
+  uint64_t const overhead = bench_timer_overhead();
+
+  fprintf(report_table, "%s on %s, %ld cpus, timer overhead %llu ns\n", date, host, sysconf(_SC_NPROCESSORS_ONLN),
+          (unsigned long long) overhead);
+  fprintf(report_table, "%-56s %12s %12s %14s %10s %10s %10s\n", "Benchmark", "Iterations", "Time(ns)", "Items/s",
+          "p50", "p99", "p999");
+
+  if (!report_json)
+    return;
+  fprintf(report_json, "{\n  \"context\": {\n    \"date\": ");
+  bench_json_string(report_json, date);
+  fprintf(report_json, ",\n    \"host_name\": ");
+  bench_json_string(report_json, host);
+  fprintf(report_json, ",\n    \"executable\": ");
+  bench_json_string(report_json, executable);
+  fprintf(report_json, ",\n    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef NDEBUG
+  fprintf(report_json, "    \"library_build_type\": \"release\",\n");
+#else
+  fprintf(report_json, "    \"library_build_type\": \"debug\",\n");
+#endif
+  fprintf(report_json, "    \"seed\": %lu,\n    \"timer_overhead_ns\": %llu\n  },\n  \"benchmarks\": [", opts->seed,
+          (unsigned long long) overhead);
+}
+
+void bench_report(bench_run_t const* tp, bench_run_t* lat, char const* counters) {
+  bench_run_t const* run = tp ? tp : lat;
+  double const ops = run->ops ? (double) run->ops : 1.0;
+  double const real = (double) run->real_ns / ops;
+  double const cpu = (double) run->cpu_ns / ops;
+  double const items = run->real_ns ? (double) run->ops * 1e9 / (double) run->real_ns : 0.0;
+  bench_pct_t const pct = lat ? bench_percentiles(&lat->lat) : (bench_pct_t){0, 0, 0, 0};
+
+  fprintf(report_table, "%-56s %12zu %12.1f %14.0f %10.0f %10.0f %10.0f\n", run->name, run->ops, real, items, pct.p50,
+          pct.p99, pct.p999);
+  fflush(report_table);
+
+  if (!report_json)
+    return;
+  fprintf(report_json, "%s\n    {\n      \"name\": ", report_count++ ? "," : "");
+  bench_json_string(report_json, run->name);
+  fprintf(report_json, ",\n      \"run_name\": ");
+  bench_json_string(report_json, run->name);
+  fprintf(report_json,
+          ",\n      \"run_type\": \"iteration\",\n      \"iterations\": %zu,\n      \"real_time\": %.3f,\n"
+          "      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\",\n      \"items_per_second\": %.3f,\n"
+          "      \"p50_ns\": %.1f,\n      \"p99_ns\": %.1f,\n      \"p999_ns\": %.1f,\n      \"max_ns\": %.1f",
+          run->ops, real, cpu, items, pct.p50, pct.p99, pct.p999, pct.max);
+  if (counters && *counters)
+    fprintf(report_json, ",\n      %s", counters);
+  fprintf(report_json, "\n    }");
+  fflush(report_json);
+}
+
+void bench_report_close(void) {
+  if (!report_json)
+    return;
+  fprintf(report_json, "\n  ]\n}\n");
+  if (report_json != stdout)
+    fclose(report_json);
+  report_json = NULL;
+}
@@ -33,6 +33,12 @@ inline static void* mvoid_get(mvoid_t const* ptr) {
   return NULL;
 }
 
+/* Keep the target of a relative pointer that was copied delta bytes away (e.g. by mpool_compact) */
+inline static void mvoid_rebase(mvoid_t* ptr, ptrdiff_t delta) {
+  if (ptr->offset && INTPTR_MIN != ptr->offset)
+    ptr->offset -= delta;
+}
+
 /*---------------------------------------------------------------------------*/
 /** memory pool allocator (mpool) */
 
@@ -51,16 +57,27 @@ size_t mpool_size_stuff(size_t total_memory_size);
 typedef struct mpool_s mpool_t;
 
 /**
- * Attach to an existing memory pool (previously formatted).
+ * Attach to an existing memory pool (previously formatted). Return NULL
+ * with errno EPROTO for a pool of another layout version, EINVAL when the
+ * memory holds no pool.
  */
 mpool_t* mpool_attach_existing(void*);
 
 /**
  * Format raw memory as a memory pool.
  * Memory must be pre-allocated and large enough (use mpool_size_hint()).
+ * A pool holds at most 2^32 - 2 tags of 16 bytes (about 64 GiB), larger
+ * regions are rejected with NULL.
  */
 mpool_t* mpool_format_memory(void* addr, size_t);
 
+/**
+ * Grow pool to a larger size in place (memory behind the pool must be valid,
+ * e.g. after mshm_resize). The new tail becomes free space. Return 0 on success,
+ * 1 when shrinking or exceeding the tag limit of mpool_format_memory.
+ */
+int mpool_extend(mpool_t*, size_t);
+
 /**
  * Completely cleanup memory pool (zero state, no deallocation of raw memory).
  */
@@ -96,6 +113,93 @@ size_t mpool_free_space(mpool_t const*);
  */
 double mpool_utilization(mpool_t const*);
 
+/* pool statistics snapshot */
+typedef struct {
+  size_t total_size;   /* pool size in bytes */
+  size_t capacity;     /* payload capacity */
+  size_t used;         /* bytes held by allocated blocks */
+  size_t free;         /* payload bytes available in free blocks */
+  size_t free_blocks;  /* number of free blocks */
+  size_t largest_free; /* largest single allocation that can succeed */
+} mpool_stats_t;
+
+/**
+ * Fill statistics snapshot from counters kept by alloc/free. O(1): only the
+ * first call after the last largest free block was taken walks the top size
+ * class, the result is cached in the pool for the following calls.
+ */
+void mpool_stats(mpool_t const*, mpool_stats_t*);
+
+/* pool block, allocated or free, in address order */
+typedef struct {
+  void* ptr;   /* payload */
+  size_t size; /* payload bytes */
+  int used;
+} mpool_block_t;
+
+/**
+ * Step over all blocks (pos starts at 0) in one linear walk of the tags.
+ * Return 0 at the end; invalidated by pool updates.
+ */
+int mpool_next_block(mpool_t const*, size_t* pos, mpool_block_t*);
+
+#define MPOOL_HIST_BUCKETS 64
+
+/* block size distribution, bucket i holds payload sizes in [2^i, 2^(i+1)) */
+typedef struct {
+  size_t free_count[MPOOL_HIST_BUCKETS];
+  size_t free_bytes[MPOOL_HIST_BUCKETS];
+  size_t used_count[MPOOL_HIST_BUCKETS];
+  size_t used_bytes[MPOOL_HIST_BUCKETS];
+  size_t free_blocks;
+  size_t used_blocks;
+  size_t free;          /* payload bytes in free blocks */
+  size_t used;          /* payload bytes in allocated blocks */
+  size_t largest_free;  /* largest single allocation that can succeed */
+  double fragmentation; /* external fragmentation, 1 - largest_free / free (0 when free is 0) */
+} mpool_histogram_t;
+
+/**
+ * Fill histogram in a single pass over the blocks, O(blocks). To keep the
+ * lock short, run it on a private copy of the pool memory (the pool only
+ * holds relative pointers). Return 0 on success, 1 when the walk does not
+ * reach the end of the pool (corrupted or torn copy).
+ */
+int mpool_histogram(mpool_t const*, mpool_histogram_t*);
+
+/*
+ * Allocator hot-path counters. They live in the pool header of every build
+ * but are only maintained by a library built with MPOOL_STATS=1 (cmake
+ * -DWITHSTATS=ON); otherwise the instrumentation compiles to nothing.
+ * Average probe lengths are probes / searches.
+ */
+typedef struct {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t reallocs;
+  uint64_t alloc_failed;   /* allocations that returned NULL */
+  uint64_t searches;       /* free bin searches */
+  uint64_t search_probes;  /* free tags inspected by searches */
+  uint64_t search_max;     /* longest single search */
+  uint64_t merges_left;    /* coalescing with the left neighbour */
+  uint64_t merges_right;   /* coalescing with the right neighbour */
+  uint64_t scans;          /* boundary bitmap scans for a left neighbour */
+  uint64_t scan_words;     /* bitmap words read by scans */
+  uint64_t scan_max;       /* longest single scan */
+} mpool_counters_t;
+
+/**
+ * Copy counters without taking any lock (safe against a concurrent writer in
+ * another process). Return 0 when the pool is maintained by a MPOOL_STATS
+ * build, 1 when the counters are not kept.
+ */
+int mpool_counters(mpool_t const*, mpool_counters_t*);
+
+/**
+ * Zero counters.
+ */
+void mpool_counters_reset(mpool_t*);
+
 /**
  * Allocate memory from pool.
  * Returns pointer to allocated block or NULL if not enough space.
@@ -123,16 +227,329 @@ void mpool_free(mpool_t*, void*);
  */
 void* mpool_memdup(mpool_t*, void const*, size_t);
 
+/**
+ * Return usable payload size of allocated block (may exceed requested size).
+ */
+size_t mpool_block_size(void const*);
+
+/*
+ * Relocation callback of mpool_compact. Before a block (size payload bytes)
+ * moves it is called with ptr NULL: return non-zero to pin it at old. After
+ * the move it gets the new address, the old memory may be overwritten; it
+ * must redirect every reference to old and rebase relative pointers in the
+ * block that lead outside of it (mvoid_rebase, avltree_relocate,
+ * list_relocate), the result is ignored. It must not allocate or free in
+ * the pool.
+ *
+ * Only blocks the caller can patch may move: pin the pages and nodes of
+ * mslab, marena, btree_t, hashtable_t, mring_t and mchan_t, their internal
+ * links are not reachable from the callback. Blocks parked in an mcache are
+ * unknown to the caller, flush every mcache of the pool before compacting.
+ */
+typedef int (*mpool_relocate_f)(void* ptr, void const* old, size_t size, void* arg);
+
+/**
+ * Incremental compaction: slide movable blocks towards the pool start so
+ * free space gathers at the end (in one block when nothing is pinned). A
+ * call moves at most budget payload bytes (at least one block), *cursor
+ * (start at 0) keeps the position between calls. Return 1 while work
+ * remains, 0 when done.
+ */
+int mpool_compact(mpool_t*, size_t* cursor, size_t budget, mpool_relocate_f relocate, void* arg);
+
+/*---------------------------------------------------------------------------*/
+/* fixed-size object slab (mslab) */
+
+/*
+ * Equal-sized objects carved from pool pages, no per-object header,
+ * O(1) alloc/free. Like mpool, a slab in shared memory is guarded by caller.
+ */
+typedef struct mslab_s mslab_t;
+
+/**
+ * Create slab inside the pool for objects of given size.
+ * perpage is the number of objects per pool page (0 for ~4 KB pages).
+ */
+mslab_t* mslab_format(mpool_t*, size_t objsize, size_t perpage);
+
+/**
+ * Attach to an existing slab (previously formatted).
+ */
+mslab_t* mslab_attach_existing(void*);
+
+/**
+ * Return all pages and the slab itself to the pool.
+ */
+void mslab_cleanup(mslab_t*);
+
+/**
+ * Allocate one object, NULL when the pool is exhausted.
+ */
+void* mslab_alloc(mslab_t*);
+
+/**
+ * Free object previously allocated from this slab.
+ */
+void mslab_free(mslab_t*, void*);
+
+/**
+ * Return effective object size (rounded up to mvoid_t alignment).
+ */
+size_t mslab_object_size(mslab_t const*);
+
+/**
+ * Return number of allocated objects.
+ */
+size_t mslab_count(mslab_t const*);
+
+/*---------------------------------------------------------------------------*/
+/* bump-pointer arena (marena) */
+
+/*
+ * Region (raw memory or a block from mpool_alloc) handing out memory by
+ * bumping an offset: O(1) alloc, no per-object header, no single free.
+ * Memory comes back all at once with marena_reset or marena_rollback.
+ */
+typedef struct marena_s marena_t;
+
+/**
+ * Format raw memory as an arena (header included in size).
+ */
+marena_t* marena_format(void*, size_t);
+
+/**
+ * Attach to an existing arena (previously formatted).
+ */
+marena_t* marena_attach_existing(void*);
+
+/**
+ * Allocate size bytes aligned to mvoid_t, NULL when the arena is full.
+ */
+void* marena_alloc(marena_t*, size_t);
+
+/**
+ * Allocate size bytes aligned to align (power of two).
+ */
+void* marena_alloc_aligned(marena_t*, size_t, size_t align);
+
+/**
+ * Allocate and zero size bytes.
+ */
+void* marena_zalloc(marena_t*, size_t);
+
+/**
+ * Release everything allocated from the arena.
+ */
+void marena_reset(marena_t*);
+
+/**
+ * Return current position to roll back to later.
+ */
+size_t marena_checkpoint(marena_t const*);
+
+/**
+ * Release everything allocated after the checkpoint.
+ */
+void marena_rollback(marena_t*, size_t);
+
+/**
+ * Return number of bytes in use (including alignment padding).
+ */
+size_t marena_used(marena_t const*);
+
+/**
+ * Return number of bytes left.
+ */
+size_t marena_free_space(marena_t const*);
+
+/*---------------------------------------------------------------------------*/
+/* event count (mevent) */
+
+/*
+ * Process-shared wakeup primitive to wait for a condition on shared
+ * memory without polling. A zeroed mevent_t is ready to use. Waiter:
+ *
+ *   uint32_t seq = mevent_seq(ev);
+ *   if (!condition)
+ *     mevent_wait(ev, seq, timeout_ms);
+ *
+ * and re-check the condition. Notifiers change the condition first, then
+ * call mevent_notify_*: a single atomic increment when nobody waits.
+ */
+typedef struct {
+  uint64_t state; /* epoch (high half) and waiter count */
+} mevent_t;
+
+/**
+ * Return current sequence, taken before checking the condition.
+ */
+uint32_t mevent_seq(mevent_t const*);
+
+/**
+ * Sleep until notified after seq was taken or timeout_ms passes (-1 waits
+ * forever). Return 0 when woken (possibly spuriously), ETIMEDOUT on timeout.
+ */
+int mevent_wait(mevent_t*, uint32_t seq, int timeout_ms);
+
+/**
+ * Wake one or all waiters.
+ */
+void mevent_notify_one(mevent_t*);
+void mevent_notify_all(mevent_t*);
+
+/*---------------------------------------------------------------------------*/
+/* ring buffer (mring) */
+
+/*
+ * Bounded lock-free queue of fixed-size elements formatted into raw memory
+ * (a segment or a block from mpool_alloc) and attached from any process.
+ * MRING_SPSC allows one producer and one consumer, MRING_MPMC any number
+ * of both. Producer and consumer indices live on separate cache lines.
+ */
+typedef struct mring_s mring_t;
+
+/* ring flags */
+#define MRING_SPSC 0x0 /* single producer, single consumer */
+#define MRING_MPMC 0x1 /* multiple producers and consumers */
+
+/**
+ * Return memory needed for a ring of capacity (power of two) elements.
+ */
+size_t mring_calc_required_size(size_t capacity, size_t elem_size, unsigned flags);
+
+/**
+ * Format raw memory as a ring; capacity is the largest power of two that fits.
+ */
+mring_t* mring_format(void*, size_t, size_t elem_size, unsigned flags);
+
+/**
+ * Attach to an existing ring (previously formatted).
+ */
+mring_t* mring_attach_existing(void*);
+
+size_t mring_capacity(mring_t const*);
+size_t mring_elem_size(mring_t const*);
+
+/**
+ * Return number of queued elements (a snapshot while others run).
+ */
+size_t mring_count(mring_t const*);
+
+/**
+ * Copy up to n elements into the ring, return number enqueued (0 when full).
+ */
+size_t mring_enqueue(mring_t*, void const*, size_t n);
+
+/**
+ * Copy up to n elements out of the ring, return number dequeued (0 when empty).
+ */
+size_t mring_dequeue(mring_t*, void*, size_t n);
+
+/**
+ * Like mring_enqueue/mring_dequeue but sleep (futex) until at least one
+ * element is moved or timeout_ms passes (-1 waits forever). Return number
+ * of elements moved, 0 on timeout.
+ */
+size_t mring_enqueue_wait(mring_t*, void const*, size_t n, int timeout_ms);
+size_t mring_dequeue_wait(mring_t*, void*, size_t n, int timeout_ms);
+
+/*---------------------------------------------------------------------------*/
+/* message channel (mchan) */
+
+/*
+ * Single producer, single consumer channel of variable-length messages in
+ * a byte ring formatted into raw memory (a segment or a block from
+ * mpool_alloc). Messages are written and read in place: the producer
+ * reserves space and commits it, the consumer peeks the oldest message and
+ * releases it. Positions are offsets, so both sides may map the memory at
+ * different addresses. Payloads are aligned to 8 bytes.
+ */
+typedef struct mchan_s mchan_t;
+
+/**
+ * Format raw memory as a channel; the ring is the largest power of two that fits.
+ */
+mchan_t* mchan_format(void*, size_t);
+
+/**
+ * Attach to an existing channel (previously formatted).
+ */
+mchan_t* mchan_attach_existing(void*);
+
+/**
+ * Return size of the byte ring; a message (plus 8 bytes of header) may
+ * take up to half of it.
+ */
+size_t mchan_capacity(mchan_t const*);
+
+/**
+ * Return pointer to size bytes of contiguous space for the next message,
+ * NULL when the channel is full (or size is too big). Nothing is visible
+ * until mchan_commit.
+ */
+void* mchan_reserve(mchan_t*, size_t);
+
+/**
+ * Publish the reserved message with its final size (not above the reserved one).
+ */
+void mchan_commit(mchan_t*, size_t);
+
+/**
+ * Return pointer to the oldest message and its size, NULL when empty.
+ * The message stays valid until mchan_release.
+ */
+void* mchan_peek(mchan_t*, size_t*);
+
+/**
+ * Drop the message returned by mchan_peek, making its space reusable.
+ */
+void mchan_release(mchan_t*);
+
 /*---------------------------------------------------------------------------*/
 /* shared memory interface */
 
 typedef void mshm_t;
 
+/* creation flags */
+#define MSHM_MUTEX 0x1     /* robust process-shared mutex in the segment instead of named semaphore */
+#define MSHM_HUGETLB 0x2   /* back by a file in MSHM_HUGETLBFS, falls back to MSHM_HUGEPAGE */
+#define MSHM_HUGEPAGE 0x4  /* transparent huge pages, madvise(MADV_HUGEPAGE) */
+#define MSHM_POPULATE 0x8  /* pre-fault the whole mapping */
+#define MSHM_MLOCK 0x10    /* lock the mapping in RAM */
+
+/* hugetlbfs mount point used by MSHM_HUGETLB */
+#ifndef MSHM_HUGETLBFS
+#define MSHM_HUGETLBFS "/dev/hugepages"
+#endif
+
+/* NUMA memory policy (values of the kernel MPOL_* modes), also covers memory added by mshm_resize */
+#define MSHM_NUMA_DEFAULT 0
+#define MSHM_NUMA_PREFERRED 1
+#define MSHM_NUMA_BIND 2
+#define MSHM_NUMA_INTERLEAVE 3
+
+/* creation options */
+typedef struct {
+  unsigned flags;           /* MSHM_* flags */
+  int numa_policy;          /* MSHM_NUMA_* policy */
+  unsigned long numa_nodes; /* node bitmask for numa_policy */
+} mshm_options_t;
+
 /**
  * Create named shared memory segment.
  */
 mshm_t* mshm_create(char const*, size_t);
 
+/**
+ * Create named shared memory segment with options (NULL for defaults).
+ * Only the process that creates the file initialises the header, others
+ * wait for it and keep its options; an existing segment is never made
+ * smaller than its current size. Fails with EPROTO on a segment of another
+ * version and EINVAL on one that never gets a valid header. Page flags
+ * (huge pages, populate, mlock) are also applied by mshm_open.
+ */
+mshm_t* mshm_create_ex(char const*, size_t, mshm_options_t const*);
+
 /**
  * Open existing shared memory segment.
  */
@@ -148,18 +565,36 @@ void mshm_unlink(char const*);
  */
 void mshm_cleanup(mshm_t*);
 
+/**
+ * Grow segment to a new size (shrinking below the size in the segment header
+ * is not allowed, the handle is refreshed first), the memory address may
+ * change. Other handles pick the size up with mshm_refresh. The caller
+ * serialises resizes, e.g. under mshm_lock, and then grows the content
+ * (see mpool_extend). Return 0 on success.
+ */
+int mshm_resize(mshm_t*, size_t);
+
+/**
+ * Follow a size change made through another handle (cheap when nothing
+ * changed). mshm_memory_ptr must be re-read afterwards. Return 0 on success.
+ */
+int mshm_refresh(mshm_t*);
+
 /**
  * Return shm name.
  */
 char const* mshm_name(mshm_t const*);
 
 /**
- * Try lock shared memory segment (non-blocking).
+ * Try lock shared memory segment (non-blocking), results as mshm_lock.
  */
 int mshm_trylock(mshm_t*);
 
 /**
- * Lock shared memory segment (blocking).
+ * Lock shared memory segment (blocking). Return 0 when locked, 1 on error
+ * (errno set). With MSHM_MUTEX a lock left by a dead owner is recovered:
+ * EOWNERDEAD is returned with the lock held, the protected data may be
+ * half-updated and should be checked before use.
  */
 int mshm_lock(mshm_t*);
 
@@ -173,16 +608,121 @@ int mshm_unlock(mshm_t*);
  */
 int mshm_unlock_force(mshm_t*);
 
+/*
+ * Reader/writer lock stored in the segment, independent of mshm_lock.
+ * Writers are preferred: once a writer waits, new readers queue behind it.
+ * Unlike MSHM_MUTEX it is not recovered when a holder dies.
+ */
+
+/**
+ * Lock segment for reading (shared, blocking).
+ */
+int mshm_rdlock(mshm_t*);
+
+/**
+ * Lock segment for writing (exclusive, blocking).
+ */
+int mshm_wrlock(mshm_t*);
+
+/**
+ * Try read lock (non-blocking).
+ */
+int mshm_tryrdlock(mshm_t*);
+
+/**
+ * Try write lock (non-blocking).
+ */
+int mshm_trywrlock(mshm_t*);
+
+/**
+ * Release read or write lock.
+ */
+int mshm_rwunlock(mshm_t*);
+
 /**
  * Return raw pointer to shm memory.
  */
 void* mshm_memory_ptr(mshm_t const*);
 
 /**
- * Return size of shm memory segment.
+ * Return size of shm memory segment as last set by mshm_create/mshm_resize.
+ * Read from the segment header, no system call.
  */
 size_t mshm_memory_size(mshm_t const*);
 
+/**
+ * Return size of memory mapped by this handle (differs from
+ * mshm_memory_size until mshm_refresh follows a resize).
+ */
+size_t mshm_mapped_size(mshm_t const*);
+
+/**
+ * Return segment generation, changed by every resize.
+ */
+uint64_t mshm_generation(mshm_t const*);
+
+/*
+ * Event count in the segment header (see mevent_t): wait for changes made
+ * by other processes, e.g. a list_t filled under mshm_lock.
+ */
+
+/**
+ * Return current event sequence.
+ */
+uint32_t mshm_event(mshm_t const*);
+
+/**
+ * Sleep until notified after seq was taken or timeout_ms passes (-1 waits
+ * forever). Return 0 when woken, ETIMEDOUT on timeout.
+ */
+int mshm_wait(mshm_t*, uint32_t seq, int timeout_ms);
+
+/**
+ * Wake one or all processes in mshm_wait.
+ */
+void mshm_notify_one(mshm_t*);
+void mshm_notify_all(mshm_t*);
+
+/*---------------------------------------------------------------------------*/
+/* allocation cache (mcache) */
+
+/*
+ * Process-local magazines of small blocks in front of a shared pool.
+ * Hits take no lock at all, refills and flushes move blocks in batches
+ * under the shm lock. A cache is not thread safe: use one per thread.
+ * Cached blocks are counted as used by the pool until flushed. When the
+ * shm lock fails the pool is left alone: allocations return NULL and a
+ * block that would have to go back to the pool stays unfreed.
+ */
+typedef struct mcache_s mcache_t;
+
+/**
+ * Create cache for pool; shm is locked around refill/flush (NULL for a private pool).
+ */
+mcache_t* mcache_create(mpool_t*, mshm_t*);
+
+/**
+ * Flush all cached blocks back to the pool and destroy cache.
+ */
+void mcache_cleanup(mcache_t*);
+
+/**
+ * Allocate block, served from magazine when possible; NULL when the pool is
+ * full or the shm lock failed.
+ */
+void* mcache_alloc(mcache_t*, size_t);
+
+/**
+ * Return block to magazine (or to the pool for large blocks).
+ */
+void mcache_free(mcache_t*, void*);
+
+/**
+ * Return all cached blocks to the pool. Return 0 on success, 1 when the shm
+ * lock failed (blocks stay cached).
+ */
+int mcache_flush(mcache_t*);
+
 /*---------------------------------------------------------------------------*/
 /* offset member cast */
 
@@ -206,6 +746,7 @@ typedef int (*avltree_compare_f)(avlnode_t const*, avlnode_t const*);
 typedef struct {
   mvoid_t root;
   int height;
+  unsigned seq; /* seqlock counter, odd while a writer is active */
   mvoid_t first;
   mvoid_t last;
 } avltree_t;
@@ -219,10 +760,115 @@ avlnode_t* avltree_lookup(avlnode_t const* key, avltree_compare_f cmp, avltree_t
 avlnode_t* avltree_lower(avlnode_t const* key, avltree_compare_f cmp, avltree_t const* tree);
 avlnode_t* avltree_upper(avlnode_t const* key, avltree_compare_f cmp, avltree_t const* tree);
 avlnode_t* avltree_insert(avlnode_t* node, avltree_compare_f cmp, avltree_t* tree);
+/* Link node found missing by a lookup below parent and rebalance (used by AVLTREE_DEFINE) */
+void avltree_insert_link(avlnode_t* node, avlnode_t* parent, avlnode_t* unbalanced, int is_left, avltree_t* tree);
 void avltree_remove(avlnode_t* node, avltree_t* tree);
 void avltree_replace(avlnode_t* old, avlnode_t* node, avltree_t* tree);
+/* Relink node copied from old (old is not read), for mpool_compact; linked nodes must live in other blocks */
+void avltree_relocate(avlnode_t* node, avlnode_t const* old, avltree_t* tree);
 int avltree_init(avltree_t* tree);
 
+/*
+ * Build a balanced tree from nodes in ascending order in O(n), no comparisons.
+ * Previous tree content is dropped (nodes are not touched).
+ */
+void avltree_build_sorted(avlnode_t** nodes, size_t n, avltree_t* tree);
+
+/*
+ * Seqlock for read-mostly trees. Writers (serialised by the caller, e.g.
+ * mshm_lock) wrap insert/remove/replace in avltree_write_begin/end. Readers
+ * take no lock:
+ *
+ *   do {
+ *     seq = avltree_read_begin(tree);
+ *     node = avltree_lookup_seq(key, cmp, tree, lo, hi);
+ *     ... copy what is needed from node ...
+ *   } while (avltree_read_retry(tree, seq));
+ *
+ * The _seq lookups may see a tree in the middle of a change: every node they
+ * visit is checked to lie in [lo, hi) and the walk length is bounded, so a
+ * torn read yields a wrong result (caught by avltree_read_retry), never a
+ * stray access. hi should leave room for the whole object read by cmp.
+ */
+void avltree_write_begin(avltree_t* tree);
+void avltree_write_end(avltree_t* tree);
+unsigned avltree_read_begin(avltree_t const* tree);
+int avltree_read_retry(avltree_t const* tree, unsigned seq);
+avlnode_t* avltree_lookup_seq(avlnode_t const* key, avltree_compare_f cmp, avltree_t const* tree, void const* lo,
+                              void const* hi);
+avlnode_t* avltree_lower_seq(avlnode_t const* key, avltree_compare_f cmp, avltree_t const* tree, void const* lo,
+                             void const* hi);
+
+/*
+ * Key-specialised AVL operations with the comparison inlined:
+ *
+ *   #define person_cmp(a, b) ((a)->age - (b)->age)
+ *   AVLTREE_DEFINE(person_tree, person_t, node, person_cmp)
+ *
+ * emits person_tree_lookup/lower/upper(tree, key) and
+ * person_tree_insert(tree, obj), working on person_t pointers and
+ * compatible with the generic avltree_* functions on the same tree.
+ * keycmp(a, b) takes two type const* and returns <0, 0 or >0.
+ */
+#define AVLTREE_DEFINE(name, type, member, keycmp)                                                                   \
+  static inline type* name##_entry(avlnode_t const* node) {                                                          \
+    return node ? mcontainer_of(node, type, member) : (type*) 0;                                                     \
+  }                                                                                                                  \
+  static inline type* name##_lookup(avltree_t const* tree, type const* key) {                                        \
+    avlnode_t* node = (avlnode_t*) mvoid_get(&tree->root);                                                           \
+    while (node) {                                                                                                   \
+      int const rc = keycmp(name##_entry(node), key);                                                                \
+      if (!rc)                                                                                                       \
+        return name##_entry(node);                                                                                   \
+      if (rc > 0)                                                                                                    \
+        node = (avlnode_t*) mvoid_get(&node->left);                                                                  \
+      else                                                                                                           \
+        node = (avlnode_t*) mvoid_get(&node->right);                                                                 \
+    }                                                                                                                \
+    return (type*) 0;                                                                                                \
+  }                                                                                                                  \
+  static inline type* name##_lower(avltree_t const* tree, type const* key) {                                         \
+    avlnode_t* node = (avlnode_t*) mvoid_get(&tree->root);                                                           \
+    avlnode_t* prev = (avlnode_t*) 0;                                                                                \
+    while (node) {                                                                                                   \
+      int const rc = keycmp(name##_entry(node), key);                                                                \
+      if (!rc)                                                                                                       \
+        return name##_entry(node);                                                                                   \
+      if (rc > 0) {                                                                                                  \
+        prev = node;                                                                                                 \
+        node = (avlnode_t*) mvoid_get(&node->left);                                                                  \
+      } else                                                                                                         \
+        node = (avlnode_t*) mvoid_get(&node->right);                                                                 \
+    }                                                                                                                \
+    return name##_entry(prev);                                                                                       \
+  }                                                                                                                  \
+  static inline type* name##_upper(avltree_t const* tree, type const* key) {                                         \
+    type* r = name##_lower(tree, key);                                                                               \
+    while (r && !keycmp(r, key))                                                                                     \
+      r = name##_entry(avltree_next(&r->member));                                                                    \
+    return r;                                                                                                        \
+  }                                                                                                                  \
+  static inline type* name##_insert(avltree_t* tree, type* obj) {                                                    \
+    avlnode_t* node = (avlnode_t*) mvoid_get(&tree->root);                                                           \
+    avlnode_t* parent = (avlnode_t*) 0;                                                                              \
+    avlnode_t* unbalanced = node;                                                                                    \
+    int is_left = 0;                                                                                                 \
+    while (node) {                                                                                                   \
+      if (node->balance)                                                                                             \
+        unbalanced = node;                                                                                           \
+      int const rc = keycmp(name##_entry(node), obj);                                                                \
+      if (!rc)                                                                                                       \
+        return name##_entry(node);                                                                                   \
+      parent = node;                                                                                                 \
+      if ((is_left = rc > 0))                                                                                        \
+        node = (avlnode_t*) mvoid_get(&node->left);                                                                  \
+      else                                                                                                           \
+        node = (avlnode_t*) mvoid_get(&node->right);                                                                 \
+    }                                                                                                                \
+    avltree_insert_link(&obj->member, parent, unbalanced, is_left, tree);                                            \
+    return (type*) 0;                                                                                                \
+  }
+
 /*---------------------------------------------------------------------------*/
 /* intrusive doubly linked list */
 
@@ -261,12 +907,192 @@ void list_push_front(listnode_t* node, list_t*);
 /* List deletion */
 void list_remove(listnode_t* node, list_t*);
 void list_replace(listnode_t* old, listnode_t* node, list_t*);
+/* Relink node copied from old (old is not read), for mpool_compact; linked nodes must live in other blocks */
+void list_relocate(listnode_t* node, listnode_t const* old, list_t*);
 
 /* List utility */
 void list_swap(listnode_t* node1, listnode_t* node2, list_t*);
 void list_sort(list_t*, list_compare_f cmp);
 int list_init(list_t*);
 
+/*
+ * Build a balanced AVL tree from a sorted list in O(n), no comparisons.
+ * delta is the offset of the avlnode_t from the listnode_t in the object,
+ * offsetof(T, avl) - offsetof(T, list). The list is left intact.
+ */
+void avltree_build_sorted_list(list_t const*, ptrdiff_t delta, avltree_t*);
+
+/*---------------------------------------------------------------------------*/
+/* B+tree with 64-bit keys */
+
+/*
+ * Keys are stored contiguously in ~512 byte nodes allocated from a pool,
+ * values (64-bit, e.g. an offset) live in linked leaves. Like avltree_t,
+ * the container may be placed in shared memory; writers are serialised
+ * by the caller.
+ */
+typedef struct {
+  mvoid_t root;
+  mvoid_t first; /* leftmost leaf */
+  mvoid_t last;  /* rightmost leaf */
+  mvoid_t pool;
+  size_t count;
+  int height; /* -1 when empty, 0 for a single leaf */
+} btree_t;
+
+/* Position in a B+tree, valid until the tree is modified */
+typedef struct {
+  void* leaf;
+  unsigned pos;
+} btree_iter_t;
+
+/* B+tree operations */
+int btree_init(btree_t*, mpool_t*);
+void btree_cleanup(btree_t*);
+size_t btree_count(btree_t const*);
+
+/* Return pointer to the value of key or NULL */
+uint64_t* btree_lookup(btree_t const*, uint64_t key);
+
+/* Return 0 when inserted, 1 when key exists (value untouched), -1 when the pool is full */
+int btree_insert(btree_t*, uint64_t key, uint64_t value);
+
+/* Return 0 when removed, 1 when key not found */
+int btree_remove(btree_t*, uint64_t key);
+
+/* Position iterator (first key >= key, first key > key, ends); return 0 when past the end */
+int btree_lower(btree_t const*, uint64_t key, btree_iter_t*);
+int btree_upper(btree_t const*, uint64_t key, btree_iter_t*);
+int btree_first(btree_t const*, btree_iter_t*);
+int btree_last(btree_t const*, btree_iter_t*);
+
+/* Step iterator; return 0 when past the end */
+int btree_next(btree_iter_t*);
+int btree_prev(btree_iter_t*);
+
+uint64_t btree_iter_key(btree_iter_t const*);
+uint64_t* btree_iter_value(btree_iter_t const*);
+
+/*---------------------------------------------------------------------------*/
+/* hash table */
+
+/*
+ * Intrusive open addressing table (Robin Hood) with relative slots in a
+ * pool. Growth is incremental: every insert/remove moves a few entries to
+ * the doubled table, no single call rehashes everything. The caller passes
+ * hash and equality per call, as function pointers stored in shared memory
+ * would be meaningless in other processes. Writers are serialised by the
+ * caller (e.g. mshm_wrlock), readers may share mshm_rdlock.
+ */
+
+/* Hash table node (stores hash of the entry) */
+typedef struct {
+  uint64_t hash;
+} hashnode_t;
+
+/* Equality callback: return non-zero when entries are equal */
+typedef int (*hashtable_equal_f)(hashnode_t const*, hashnode_t const*);
+
+/* Hash table container */
+typedef struct {
+  mvoid_t pool;
+  mvoid_t slots; /* current table */
+  mvoid_t old;   /* table being moved out, NULL when not growing */
+  size_t mask;
+  size_t old_mask;
+  size_t migrate; /* next old slot to move */
+  size_t count;
+} hashtable_t;
+
+/* Create empty table sized for hint entries; return 0 on success */
+int hashtable_init(hashtable_t*, mpool_t*, size_t hint);
+
+/* Free table memory (nodes are not touched) */
+void hashtable_cleanup(hashtable_t*);
+size_t hashtable_count(hashtable_t const*);
+
+/* Return node equal to key or NULL */
+hashnode_t* hashtable_lookup(hashtable_t const*, hashnode_t const* key, uint64_t hash, hashtable_equal_f eq);
+
+/* Return 0 when inserted, 1 when an equal node exists, -1 when the table is full */
+int hashtable_insert(hashtable_t*, hashnode_t* node, uint64_t hash, hashtable_equal_f eq);
+
+/* Unlink and return node equal to key, NULL when not found */
+hashnode_t* hashtable_remove(hashtable_t*, hashnode_t const* key, uint64_t hash, hashtable_equal_f eq);
+
+/* Iterate nodes (pos starts at 0), NULL at the end; invalidated by updates */
+hashnode_t* hashtable_next(hashtable_t const*, size_t* pos);
+
 #ifdef __cplusplus
 }
+
+namespace mitosha {
+
+/*
+ * C++ counterpart of AVLTREE_DEFINE for T derived from avlnode_t.
+ * Compare()(T const&, T const&) returns <0, 0 or >0 and is inlined.
+ */
+template <typename T, typename Compare> struct avltree_ops {
+  static T* entry(avlnode_t const* node) { return static_cast<T*>(const_cast<avlnode_t*>(node)); }
+
+  /* branch rather than select: a predicted branch lets the next load start early */
+  static avlnode_t* child(avlnode_t const* node, int rc) {
+    if (rc > 0)
+      return static_cast<avlnode_t*>(mvoid_get(&node->left));
+    return static_cast<avlnode_t*>(mvoid_get(&node->right));
+  }
+
+  static T* lookup(avltree_t const* tree, T const& key) {
+    avlnode_t* node = static_cast<avlnode_t*>(mvoid_get(&tree->root));
+    while (node) {
+      int const rc = Compare()(*entry(node), key);
+      if (!rc)
+        return entry(node);
+      node = child(node, rc);
+    }
+    return nullptr;
+  }
+
+  static T* lower(avltree_t const* tree, T const& key) {
+    avlnode_t* node = static_cast<avlnode_t*>(mvoid_get(&tree->root));
+    avlnode_t* prev = nullptr;
+    while (node) {
+      int const rc = Compare()(*entry(node), key);
+      if (!rc)
+        return entry(node);
+      if (rc > 0)
+        prev = node;
+      node = child(node, rc);
+    }
+    return entry(prev);
+  }
+
+  static T* upper(avltree_t const* tree, T const& key) {
+    T* r = lower(tree, key);
+    while (r && !Compare()(*r, key))
+      r = entry(avltree_next(r));
+    return r;
+  }
+
+  static T* insert(avltree_t* tree, T* obj) {
+    avlnode_t* node = static_cast<avlnode_t*>(mvoid_get(&tree->root));
+    avlnode_t* parent = nullptr;
+    avlnode_t* unbalanced = node;
+    int is_left = 0;
+    while (node) {
+      if (node->balance)
+        unbalanced = node;
+      int const rc = Compare()(*entry(node), *obj);
+      if (!rc)
+        return entry(node);
+      parent = node;
+      is_left = rc > 0;
+      node = child(node, rc);
+    }
+    avltree_insert_link(obj, parent, unbalanced, is_left, tree);
+    return nullptr;
+  }
+};
+
+} // namespace mitosha
 #endif
@@ -12,28 +12,47 @@ QMAKE_CFLAGS += -std=c11
 QMAKE_LFLAGS += -std=c++11 -std=c11
 
 HEADERS += \
+    ../bench/bench.h \
     ../include/mitosha.h
 
 SOURCES += \
+    ../bench/bench.c \
+    ../bench/bench_mp.c \
+    ../bench/bench_util.c \
+    ../src/arena.c \
     ../src/avl.c \
+    ../src/cache.c \
+    ../src/chan.c \
     ../src/btree.c \
+    ../src/event.c \
+    ../src/hash.c \
     ../src/list.c \
     ../src/test/test_avl.c \
     ../src/test/test_avl_perf.cpp \
     ../src/test/test_page.c \
     ../src/test/test_list.c \
     ../src/pool.c \
+    ../src/ring.c \
+    ../tests/test_arena.c \
     ../tests/test_btree.c \
+    ../tests/test_cache.c \
+    ../tests/test_event.c \
+    ../tests/test_chan.c \
+    ../tests/test_hash.c \
     ../tests/test_list.c \
+    ../tests/test_ring.c \
     ../src/shma.c \
+    ../src/slab.c \
     ../tests/test_uni.c \
     ../tests/test_shm.c \
+    ../tests/test_slab.c \
     ../tests/test_pool.cc \
     ../tests/test_perf.cpp \
     ../tests/test_avltree.c
 
 OTHER_FILES += \
     ../CMakeLists.txt \
+    ../bench/CMakeLists.txt \
     ../src/CMakeLists.txt \
     ../test/CMakeLists.txt
 
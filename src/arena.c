@@ -0,0 +1,95 @@
+#include <mitosha.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Bump-pointer arena: objects are carved from the region behind the header
+ * without any per-object header and only released all at once (reset) or
+ * back to a checkpoint. The state is a single offset, so the arena works
+ * from any mapping address.
+ */
+struct marena_s {
+  size_t marker;
+  size_t size; /* bytes available behind the header */
+  size_t used; /* bump offset */
+};
+
+static const size_t MARENA_MARKER = 0x4d4152454e41fafa; // MARENA
+
+#define MARENA_ALIGN sizeof(mvoid_t)
+
+static inline char* arena_base(marena_t const* arena) {
+  return (char*) (arena + 1);
+}
+
+marena_t* marena_format(void* addr, size_t size) {
+  if (!addr || size < sizeof(marena_t)) {
+    fprintf(stderr, "%s need %zu or more memory\n", __func__, sizeof(marena_t));
+    return NULL;
+  }
+  marena_t* arena = (marena_t*) addr;
+  arena->marker = MARENA_MARKER;
+  arena->size = size - sizeof(marena_t);
+  arena->used = 0;
+  return arena;
+}
+
+marena_t* marena_attach_existing(void* src) {
+  if (!src)
+    return NULL;
+  marena_t* arena = (marena_t*) src;
+  if (arena->marker == MARENA_MARKER)
+    return arena;
+  fprintf(stderr, "%s invalid MARENA marker\n", __func__);
+  return NULL;
+}
+
+void* marena_alloc_aligned(marena_t* arena, size_t size, size_t align) {
+  if (!align || (align & (align - 1))) {
+    fprintf(stderr, "%s alignment must be a power of two\n", __func__);
+    return NULL;
+  }
+  uintptr_t const base = (uintptr_t) arena_base(arena);
+  uintptr_t const ptr = (base + arena->used + align - 1) & ~(uintptr_t) (align - 1);
+  size_t const offset = ptr - base;
+  if (offset > arena->size || size > arena->size - offset)
+    return NULL;
+  arena->used = offset + size;
+  return (void*) ptr;
+}
+
+void* marena_alloc(marena_t* arena, size_t size) {
+  return marena_alloc_aligned(arena, size, MARENA_ALIGN);
+}
+
+void* marena_zalloc(marena_t* arena, size_t size) {
+  void* ptr = marena_alloc(arena, size);
+  if (ptr)
+    memset(ptr, 0, size);
+  return ptr;
+}
+
+void marena_reset(marena_t* arena) {
+  arena->used = 0;
+}
+
+size_t marena_checkpoint(marena_t const* arena) {
+  return arena->used;
+}
+
+void marena_rollback(marena_t* arena, size_t mark) {
+  if (mark > arena->used) {
+    fprintf(stderr, "%s checkpoint is ahead of the arena\n", __func__);
+    return;
+  }
+  arena->used = mark;
+}
+
+size_t marena_used(marena_t const* arena) {
+  return arena->used;
+}
+
+size_t marena_free_space(marena_t const* arena) {
+  return arena->size - arena->used;
+}
@@ -229,6 +229,11 @@ avlnode_t* avltree_insert(avlnode_t* node, avltree_compare_f cmp, avltree_t* tre
   if (key)
     return key;
 
+  avltree_insert_link(node, parent, unbalanced, is_left, tree);
+  return NULL;
+}
+
+void avltree_insert_link(avlnode_t* node, avlnode_t* parent, avlnode_t* unbalanced, int is_left, avltree_t* tree) {
   INIT_NODE_AVL(node);
 
   if (!parent) {
@@ -237,7 +242,7 @@ avlnode_t* avltree_insert(avlnode_t* node, avltree_compare_f cmp, avltree_t* tre
     mvoid_set(&tree->first, node);
     mvoid_set(&tree->last, node);
     tree->height++;
-    return NULL;
+    return;
   }
 
   if (is_left) {
@@ -337,7 +342,6 @@ avlnode_t* avltree_insert(avlnode_t* node, avltree_compare_f cmp, avltree_t* tre
     break;
   }
   }
-  return NULL;
 }
 
 /* Deletion might require up to log(n) rotations */
@@ -537,10 +541,175 @@ void avltree_replace(avlnode_t* old, avlnode_t* n, avltree_t* tree) {
   mvoid_set(&n->right, mvoid_get(&old->right));
 }
 
+void avltree_relocate(avlnode_t* n, const avlnode_t* old, avltree_t* tree) {
+  ptrdiff_t const delta = (char*) n - (const char*) old;
+  mvoid_rebase(&n->parent, delta);
+  mvoid_rebase(&n->left, delta);
+  mvoid_rebase(&n->right, delta);
+
+  avlnode_t* parent = get_parent_avl(n);
+  if (parent) {
+    set_child_avl(n, parent, mvoid_get(&parent->left) == old);
+  } else {
+    mvoid_set(&tree->root, n);
+  }
+
+  if (mvoid_get(&n->left))
+    set_parent_avl(n, mvoid_get(&n->left));
+  if (mvoid_get(&n->right))
+    set_parent_avl(n, mvoid_get(&n->right));
+
+  if (mvoid_get(&tree->first) == old)
+    mvoid_set(&tree->first, n);
+  if (mvoid_get(&tree->last) == old)
+    mvoid_set(&tree->last, n);
+}
+
 int avltree_init(avltree_t* tree) {
   mvoid_set(&tree->root, NULL);
   tree->height = -1;
+  tree->seq = 0;
   mvoid_set(&tree->first, NULL);
   mvoid_set(&tree->last, NULL);
   return 0;
 }
+
+/*
+ * Bulk build
+ */
+typedef struct {
+  avlnode_t** nodes;     /* array source */
+  listnode_t const* cur; /* list source */
+  ptrdiff_t delta;
+} avl_build_src_t;
+
+static inline avlnode_t* build_next_avl(avl_build_src_t* src) {
+  if (src->nodes)
+    return *src->nodes++;
+  avlnode_t* node = (avlnode_t*) ((char*) src->cur + src->delta);
+  src->cur = mvoid_get(&src->cur->next);
+  return node;
+}
+
+/*
+ * Link the next n nodes in order, middle one as subtree root. The left half
+ * gets the larger share, so the right subtree is never higher and the
+ * balance is 0 or -1. Return subtree height (-1 when empty).
+ */
+static int build_avl(avl_build_src_t* src, size_t n, avlnode_t* parent, avlnode_t** root) {
+  if (!n) {
+    *root = NULL;
+    return -1;
+  }
+  avlnode_t* left;
+  int const lh = build_avl(src, n / 2, NULL, &left);
+  avlnode_t* node = build_next_avl(src);
+  avlnode_t* right;
+  int const rh = build_avl(src, n - n / 2 - 1, node, &right);
+
+  mvoid_set(&node->left, left);
+  mvoid_set(&node->right, right);
+  mvoid_set(&node->parent, parent);
+  set_balance(rh - lh, node);
+  if (left)
+    set_parent_avl(node, left);
+  *root = node;
+  return (lh > rh ? lh : rh) + 1;
+}
+
+static void build_tree_avl(avl_build_src_t* src, size_t n, avltree_t* tree) {
+  avlnode_t* root;
+  tree->height = build_avl(src, n, NULL, &root);
+  mvoid_set(&tree->root, root);
+  mvoid_set(&tree->first, root ? get_first_avl(root) : NULL);
+  mvoid_set(&tree->last, root ? get_last_avl(root) : NULL);
+}
+
+void avltree_build_sorted(avlnode_t** nodes, size_t n, avltree_t* tree) {
+  avl_build_src_t src = {nodes, NULL, 0};
+  build_tree_avl(&src, n, tree);
+}
+
+void avltree_build_sorted_list(const list_t* list, ptrdiff_t delta, avltree_t* tree) {
+  size_t n = 0;
+  for (listnode_t const* node = mvoid_get(&list->first); node; node = mvoid_get(&node->next))
+    ++n;
+  avl_build_src_t src = {NULL, mvoid_get(&list->first), delta};
+  build_tree_avl(&src, n, tree);
+}
+
+/*
+ * Seqlock
+ */
+#define AVL_SEQ_MAX_DEPTH 128 /* far above the height of any AVL tree */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define avl_relax() __builtin_ia32_pause()
+#else
+#define avl_relax() ((void) 0)
+#endif
+
+void avltree_write_begin(avltree_t* tree) {
+  __atomic_store_n(&tree->seq, tree->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void avltree_write_end(avltree_t* tree) {
+  __atomic_store_n(&tree->seq, tree->seq + 1, __ATOMIC_RELEASE);
+}
+
+unsigned avltree_read_begin(const avltree_t* tree) {
+  unsigned seq;
+  while ((seq = __atomic_load_n(&tree->seq, __ATOMIC_ACQUIRE)) & 1)
+    avl_relax();
+  return seq;
+}
+
+int avltree_read_retry(const avltree_t* tree, unsigned seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&tree->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/* mvoid_get for links that may change under the reader, NULL when out of bounds */
+static inline avlnode_t* get_link_seq(const mvoid_t* link, const void* lo, const void* hi) {
+  ptrdiff_t const offset = __atomic_load_n(&link->offset, __ATOMIC_RELAXED);
+  const char* node;
+  if (!offset)
+    return NULL;
+  if (offset == INTPTR_MIN)
+    node = (const char*) link;
+  else
+    node = (const char*) link + offset;
+  if (node < (const char*) lo || node >= (const char*) hi)
+    return NULL;
+  return (avlnode_t*) node;
+}
+
+avlnode_t* avltree_lookup_seq(const avlnode_t* key, avltree_compare_f cmp, const avltree_t* tree, const void* lo,
+                              const void* hi) {
+  avlnode_t* node = get_link_seq(&tree->root, lo, hi);
+  for (int depth = 0; node && depth < AVL_SEQ_MAX_DEPTH; ++depth) {
+    int const res = cmp(node, key);
+    if (res == 0)
+      return node;
+    node = get_link_seq(res > 0 ? &node->left : &node->right, lo, hi);
+  }
+  return NULL;
+}
+
+avlnode_t* avltree_lower_seq(const avlnode_t* key, avltree_compare_f cmp, const avltree_t* tree, const void* lo,
+                             const void* hi) {
+  avlnode_t* node = get_link_seq(&tree->root, lo, hi);
+  avlnode_t* prev = NULL;
+  for (int depth = 0; node && depth < AVL_SEQ_MAX_DEPTH; ++depth) {
+    int const rc = cmp(node, key);
+    if (0 == rc)
+      return node;
+    if (rc > 0) {
+      prev = node;
+      node = get_link_seq(&node->left, lo, hi);
+    } else
+      node = get_link_seq(&node->right, lo, hi);
+  }
+  return prev;
+}
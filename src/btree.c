@@ -0,0 +1,489 @@
+#include <mitosha.h>
+#include <string.h>
+
+/*
+ * B+tree with 64-bit keys. Keys of a node are stored contiguously and
+ * searched without callbacks, values live in the leaves only and leaves are
+ * chained for range scans. A node with its pool tag takes 512 bytes.
+ *
+ * Inner node: child[i] holds keys < keys[i] <= keys of child[i + 1].
+ */
+#define BTREE_KEYS 30
+#define BTREE_MIN (BTREE_KEYS / 2)
+#define BTREE_MAX_DEPTH 32 /* fanout >= 16 keeps 2^64 keys far below */
+
+typedef struct {
+  uint32_t count;
+  uint32_t leaf;
+  uint64_t keys[BTREE_KEYS];
+} bt_node_t;
+
+typedef struct {
+  bt_node_t hdr;
+  mvoid_t child[BTREE_KEYS + 1];
+} bt_inner_t;
+
+typedef struct {
+  bt_node_t hdr;
+  uint64_t values[BTREE_KEYS];
+  mvoid_t prev;
+  mvoid_t next;
+} bt_leaf_t;
+
+/* path from the root to a leaf */
+typedef struct {
+  bt_inner_t* node[BTREE_MAX_DEPTH];
+  unsigned idx[BTREE_MAX_DEPTH];
+  unsigned depth;
+} bt_path_t;
+
+/* first key >= key */
+static inline unsigned bt_lower_bound(bt_node_t const* node, uint64_t key) {
+  unsigned lo = 0, hi = node->count;
+  while (lo < hi) {
+    unsigned const mid = (lo + hi) / 2;
+    if (node->keys[mid] < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* first key > key */
+static inline unsigned bt_upper_bound(bt_node_t const* node, uint64_t key) {
+  unsigned lo = 0, hi = node->count;
+  while (lo < hi) {
+    unsigned const mid = (lo + hi) / 2;
+    if (node->keys[mid] <= key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static inline void* bt_child(bt_inner_t const* node, unsigned i) {
+  return mvoid_get(&node->child[i]);
+}
+
+/* mvoid_t can not be memmoved: shift links one by one */
+static void bt_child_shift(bt_inner_t* node, unsigned from, unsigned to, int by) {
+  if (by > 0) {
+    for (unsigned i = to; i-- > from;)
+      mvoid_set(&node->child[i + by], bt_child(node, i));
+  } else {
+    for (unsigned i = from; i < to; ++i)
+      mvoid_set(&node->child[i + by], bt_child(node, i));
+  }
+}
+
+static void* bt_alloc(btree_t* tree, int leaf) {
+  size_t const size = leaf ? sizeof(bt_leaf_t) : sizeof(bt_inner_t);
+  bt_node_t* node = mpool_alloc(mvoid_get(&tree->pool), size);
+  if (node) {
+    node->count = 0;
+    node->leaf = leaf;
+  }
+  return node;
+}
+
+static void bt_free(btree_t* tree, void* node) {
+  mpool_free(mvoid_get(&tree->pool), node);
+}
+
+/* descend to the leaf that may hold key */
+static bt_leaf_t* bt_descend(btree_t const* tree, uint64_t key, bt_path_t* path) {
+  bt_node_t* node = mvoid_get(&tree->root);
+  if (path)
+    path->depth = 0;
+  while (node && !node->leaf) {
+    unsigned const idx = bt_upper_bound(node, key);
+    if (path) {
+      path->node[path->depth] = (bt_inner_t*) node;
+      path->idx[path->depth++] = idx;
+    }
+    node = bt_child((bt_inner_t*) node, idx);
+  }
+  return (bt_leaf_t*) node;
+}
+
+int btree_init(btree_t* tree, mpool_t* pool) {
+  mvoid_set(&tree->root, NULL);
+  mvoid_set(&tree->first, NULL);
+  mvoid_set(&tree->last, NULL);
+  mvoid_set(&tree->pool, pool);
+  tree->count = 0;
+  tree->height = -1;
+  return 0;
+}
+
+static void bt_destroy(btree_t* tree, bt_node_t* node) {
+  if (!node->leaf) {
+    for (unsigned i = 0; i <= node->count; ++i)
+      bt_destroy(tree, bt_child((bt_inner_t*) node, i));
+  }
+  bt_free(tree, node);
+}
+
+void btree_cleanup(btree_t* tree) {
+  bt_node_t* root = mvoid_get(&tree->root);
+  if (root)
+    bt_destroy(tree, root);
+  btree_init(tree, mvoid_get(&tree->pool));
+}
+
+size_t btree_count(btree_t const* tree) {
+  return tree->count;
+}
+
+uint64_t* btree_lookup(btree_t const* tree, uint64_t key) {
+  bt_leaf_t* leaf = bt_descend(tree, key, NULL);
+  if (!leaf)
+    return NULL;
+  unsigned const pos = bt_lower_bound(&leaf->hdr, key);
+  if (pos < leaf->hdr.count && leaf->hdr.keys[pos] == key)
+    return &leaf->values[pos];
+  return NULL;
+}
+
+/* normalize iterator past the end of a leaf */
+static int bt_iter_fix(btree_iter_t* it) {
+  while (it->leaf && it->pos >= ((bt_leaf_t*) it->leaf)->hdr.count) {
+    it->leaf = mvoid_get(&((bt_leaf_t*) it->leaf)->next);
+    it->pos = 0;
+  }
+  return it->leaf != NULL;
+}
+
+int btree_lower(btree_t const* tree, uint64_t key, btree_iter_t* it) {
+  it->leaf = bt_descend(tree, key, NULL);
+  it->pos = it->leaf ? bt_lower_bound(it->leaf, key) : 0;
+  return bt_iter_fix(it);
+}
+
+int btree_upper(btree_t const* tree, uint64_t key, btree_iter_t* it) {
+  it->leaf = bt_descend(tree, key, NULL);
+  it->pos = it->leaf ? bt_upper_bound(it->leaf, key) : 0;
+  return bt_iter_fix(it);
+}
+
+int btree_first(btree_t const* tree, btree_iter_t* it) {
+  it->leaf = mvoid_get(&tree->first);
+  it->pos = 0;
+  return bt_iter_fix(it);
+}
+
+int btree_last(btree_t const* tree, btree_iter_t* it) {
+  bt_leaf_t* leaf = mvoid_get(&tree->last);
+  it->leaf = leaf;
+  it->pos = leaf ? leaf->hdr.count - 1 : 0;
+  return leaf != NULL;
+}
+
+int btree_next(btree_iter_t* it) {
+  if (!it->leaf)
+    return 0;
+  ++it->pos;
+  return bt_iter_fix(it);
+}
+
+int btree_prev(btree_iter_t* it) {
+  if (!it->leaf)
+    return 0;
+  if (it->pos) {
+    --it->pos;
+    return 1;
+  }
+  bt_leaf_t* leaf = mvoid_get(&((bt_leaf_t*) it->leaf)->prev);
+  it->leaf = leaf;
+  it->pos = leaf ? leaf->hdr.count - 1 : 0;
+  return leaf != NULL;
+}
+
+uint64_t btree_iter_key(btree_iter_t const* it) {
+  return ((bt_leaf_t*) it->leaf)->hdr.keys[it->pos];
+}
+
+uint64_t* btree_iter_value(btree_iter_t const* it) {
+  return &((bt_leaf_t*) it->leaf)->values[it->pos];
+}
+
+/*
+ * Insertion
+ */
+static void bt_leaf_insert(bt_leaf_t* leaf, unsigned pos, uint64_t key, uint64_t value) {
+  unsigned const n = leaf->hdr.count - pos;
+  memmove(&leaf->hdr.keys[pos + 1], &leaf->hdr.keys[pos], n * sizeof(uint64_t));
+  memmove(&leaf->values[pos + 1], &leaf->values[pos], n * sizeof(uint64_t));
+  leaf->hdr.keys[pos] = key;
+  leaf->values[pos] = value;
+  ++leaf->hdr.count;
+}
+
+/* put key and its right child at pos of a non-full inner node */
+static void bt_inner_insert(bt_inner_t* node, unsigned pos, uint64_t key, void* right) {
+  memmove(&node->hdr.keys[pos + 1], &node->hdr.keys[pos], (node->hdr.count - pos) * sizeof(uint64_t));
+  bt_child_shift(node, pos + 1, node->hdr.count + 1, 1);
+  node->hdr.keys[pos] = key;
+  mvoid_set(&node->child[pos + 1], right);
+  ++node->hdr.count;
+}
+
+/* split full leaf while inserting, return the new right leaf */
+static bt_leaf_t* bt_leaf_split(btree_t* tree, bt_leaf_t* leaf, bt_leaf_t* right, unsigned pos, uint64_t key,
+                                uint64_t value) {
+  unsigned const left_count = (BTREE_KEYS + 1) / 2;
+  unsigned const move = BTREE_KEYS - left_count + (pos < left_count);
+
+  memcpy(right->hdr.keys, &leaf->hdr.keys[BTREE_KEYS - move], move * sizeof(uint64_t));
+  memcpy(right->values, &leaf->values[BTREE_KEYS - move], move * sizeof(uint64_t));
+  right->hdr.count = move;
+  leaf->hdr.count = BTREE_KEYS - move;
+  if (pos < left_count)
+    bt_leaf_insert(leaf, pos, key, value);
+  else
+    bt_leaf_insert(right, pos - leaf->hdr.count, key, value);
+
+  bt_leaf_t* next = mvoid_get(&leaf->next);
+  mvoid_set(&right->next, next);
+  mvoid_set(&right->prev, leaf);
+  mvoid_set(&leaf->next, right);
+  if (next)
+    mvoid_set(&next->prev, right);
+  else
+    mvoid_set(&tree->last, right);
+  return right;
+}
+
+/* split full inner node while inserting key/child at pos, return separator */
+static uint64_t bt_inner_split(bt_inner_t* node, bt_inner_t* right, unsigned pos, uint64_t key, void* child) {
+  uint64_t keys[BTREE_KEYS + 1];
+  void* children[BTREE_KEYS + 2];
+  for (unsigned i = 0, k = 0; i <= BTREE_KEYS; ++i) {
+    if (i == pos)
+      keys[i] = key;
+    else
+      keys[i] = node->hdr.keys[k++];
+  }
+  for (unsigned i = 0, k = 0; i <= BTREE_KEYS + 1; ++i) {
+    if (i == pos + 1)
+      children[i] = child;
+    else
+      children[i] = bt_child(node, k++);
+  }
+
+  unsigned const m = (BTREE_KEYS + 1) / 2;
+  node->hdr.count = m;
+  memcpy(node->hdr.keys, keys, m * sizeof(uint64_t));
+  for (unsigned i = 0; i <= m; ++i)
+    mvoid_set(&node->child[i], children[i]);
+
+  right->hdr.count = BTREE_KEYS - m;
+  memcpy(right->hdr.keys, &keys[m + 1], right->hdr.count * sizeof(uint64_t));
+  for (unsigned i = 0; i <= right->hdr.count; ++i)
+    mvoid_set(&right->child[i], children[m + 1 + i]);
+  return keys[m];
+}
+
+int btree_insert(btree_t* tree, uint64_t key, uint64_t value) {
+  bt_path_t path;
+  bt_leaf_t* leaf = bt_descend(tree, key, &path);
+
+  if (!leaf) {
+    if (!(leaf = bt_alloc(tree, 1)))
+      return -1;
+    mvoid_set(&leaf->prev, NULL);
+    mvoid_set(&leaf->next, NULL);
+    bt_leaf_insert(leaf, 0, key, value);
+    mvoid_set(&tree->root, leaf);
+    mvoid_set(&tree->first, leaf);
+    mvoid_set(&tree->last, leaf);
+    tree->height = 0;
+    tree->count = 1;
+    return 0;
+  }
+
+  unsigned const pos = bt_lower_bound(&leaf->hdr, key);
+  if (pos < leaf->hdr.count && leaf->hdr.keys[pos] == key)
+    return 1;
+
+  if (leaf->hdr.count < BTREE_KEYS) {
+    bt_leaf_insert(leaf, pos, key, value);
+    ++tree->count;
+    return 0;
+  }
+
+  /* reserve every node the split chain needs, so failure leaves the tree intact */
+  void* spare[BTREE_MAX_DEPTH + 1];
+  unsigned need = 1;
+  unsigned d = path.depth;
+  while (d > 0 && path.node[d - 1]->hdr.count == BTREE_KEYS) {
+    ++need;
+    --d;
+  }
+  if (!d)
+    ++need; /* new root */
+  for (unsigned i = 0; i < need; ++i) {
+    if (!(spare[i] = bt_alloc(tree, i == 0))) {
+      while (i-- > 0)
+        bt_free(tree, spare[i]);
+      return -1;
+    }
+  }
+
+  unsigned used = 0;
+  void* right = bt_leaf_split(tree, leaf, spare[used++], pos, key, value);
+  uint64_t sep = ((bt_leaf_t*) right)->hdr.keys[0];
+  ++tree->count;
+
+  for (d = path.depth; d-- > 0;) {
+    bt_inner_t* node = path.node[d];
+    if (node->hdr.count < BTREE_KEYS) {
+      bt_inner_insert(node, path.idx[d], sep, right);
+      return 0;
+    }
+    bt_inner_t* split = spare[used++];
+    sep = bt_inner_split(node, split, path.idx[d], sep, right);
+    right = split;
+  }
+
+  bt_inner_t* root = spare[used++];
+  root->hdr.count = 1;
+  root->hdr.keys[0] = sep;
+  mvoid_set(&root->child[0], mvoid_get(&tree->root));
+  mvoid_set(&root->child[1], right);
+  mvoid_set(&tree->root, root);
+  ++tree->height;
+  return 0;
+}
+
+/*
+ * Removal
+ */
+static void bt_leaf_erase(bt_leaf_t* leaf, unsigned pos) {
+  unsigned const n = leaf->hdr.count - pos - 1;
+  memmove(&leaf->hdr.keys[pos], &leaf->hdr.keys[pos + 1], n * sizeof(uint64_t));
+  memmove(&leaf->values[pos], &leaf->values[pos + 1], n * sizeof(uint64_t));
+  --leaf->hdr.count;
+}
+
+/* drop key pos and child pos + 1 of inner node */
+static void bt_inner_erase(bt_inner_t* node, unsigned pos) {
+  memmove(&node->hdr.keys[pos], &node->hdr.keys[pos + 1], (node->hdr.count - pos - 1) * sizeof(uint64_t));
+  bt_child_shift(node, pos + 2, node->hdr.count + 1, -1);
+  --node->hdr.count;
+}
+
+/* move entries from the left sibling into node (separator parent->keys[i]) */
+static void bt_borrow_left(bt_inner_t* parent, unsigned i, bt_node_t* left, bt_node_t* node) {
+  if (node->leaf) {
+    bt_leaf_t* l = (bt_leaf_t*) left;
+    bt_leaf_insert((bt_leaf_t*) node, 0, l->hdr.keys[l->hdr.count - 1], l->values[l->hdr.count - 1]);
+    --l->hdr.count;
+    parent->hdr.keys[i] = node->keys[0];
+    return;
+  }
+  bt_inner_t* l = (bt_inner_t*) left;
+  bt_inner_t* n = (bt_inner_t*) node;
+  memmove(&n->hdr.keys[1], &n->hdr.keys[0], n->hdr.count * sizeof(uint64_t));
+  bt_child_shift(n, 0, n->hdr.count + 1, 1);
+  n->hdr.keys[0] = parent->hdr.keys[i];
+  mvoid_set(&n->child[0], bt_child(l, l->hdr.count));
+  ++n->hdr.count;
+  parent->hdr.keys[i] = l->hdr.keys[--l->hdr.count];
+}
+
+/* move entries from the right sibling into node (separator parent->keys[i]) */
+static void bt_borrow_right(bt_inner_t* parent, unsigned i, bt_node_t* node, bt_node_t* right) {
+  if (node->leaf) {
+    bt_leaf_t* r = (bt_leaf_t*) right;
+    bt_leaf_t* n = (bt_leaf_t*) node;
+    n->hdr.keys[n->hdr.count] = r->hdr.keys[0];
+    n->values[n->hdr.count++] = r->values[0];
+    bt_leaf_erase(r, 0);
+    parent->hdr.keys[i] = r->hdr.keys[0];
+    return;
+  }
+  bt_inner_t* r = (bt_inner_t*) right;
+  bt_inner_t* n = (bt_inner_t*) node;
+  n->hdr.keys[n->hdr.count] = parent->hdr.keys[i];
+  mvoid_set(&n->child[++n->hdr.count], bt_child(r, 0));
+  parent->hdr.keys[i] = r->hdr.keys[0];
+  memmove(&r->hdr.keys[0], &r->hdr.keys[1], (r->hdr.count - 1) * sizeof(uint64_t));
+  bt_child_shift(r, 1, r->hdr.count + 1, -1);
+  --r->hdr.count;
+}
+
+/* append right sibling to left (separator parent->keys[i]) and free it */
+static void bt_merge(btree_t* tree, bt_inner_t* parent, unsigned i, bt_node_t* left, bt_node_t* right) {
+  if (left->leaf) {
+    bt_leaf_t* l = (bt_leaf_t*) left;
+    bt_leaf_t* r = (bt_leaf_t*) right;
+    memcpy(&l->hdr.keys[l->hdr.count], r->hdr.keys, r->hdr.count * sizeof(uint64_t));
+    memcpy(&l->values[l->hdr.count], r->values, r->hdr.count * sizeof(uint64_t));
+    l->hdr.count += r->hdr.count;
+    bt_leaf_t* next = mvoid_get(&r->next);
+    mvoid_set(&l->next, next);
+    if (next)
+      mvoid_set(&next->prev, l);
+    else
+      mvoid_set(&tree->last, l);
+  } else {
+    bt_inner_t* l = (bt_inner_t*) left;
+    bt_inner_t* r = (bt_inner_t*) right;
+    l->hdr.keys[l->hdr.count] = parent->hdr.keys[i];
+    memcpy(&l->hdr.keys[l->hdr.count + 1], r->hdr.keys, r->hdr.count * sizeof(uint64_t));
+    for (unsigned k = 0; k <= r->hdr.count; ++k)
+      mvoid_set(&l->child[l->hdr.count + 1 + k], bt_child(r, k));
+    l->hdr.count += r->hdr.count + 1;
+  }
+  bt_free(tree, right);
+  bt_inner_erase(parent, i);
+}
+
+int btree_remove(btree_t* tree, uint64_t key) {
+  bt_path_t path;
+  bt_leaf_t* leaf = bt_descend(tree, key, &path);
+  if (!leaf)
+    return 1;
+  unsigned const pos = bt_lower_bound(&leaf->hdr, key);
+  if (pos == leaf->hdr.count || leaf->hdr.keys[pos] != key)
+    return 1;
+
+  bt_leaf_erase(leaf, pos);
+  --tree->count;
+
+  bt_node_t* node = &leaf->hdr;
+  for (unsigned d = path.depth; d-- > 0 && node->count < BTREE_MIN;) {
+    bt_inner_t* parent = path.node[d];
+    unsigned const i = path.idx[d];
+    bt_node_t* left = i > 0 ? bt_child(parent, i - 1) : NULL;
+    bt_node_t* right = i < parent->hdr.count ? bt_child(parent, i + 1) : NULL;
+
+    if (left && left->count > BTREE_MIN)
+      bt_borrow_left(parent, i - 1, left, node);
+    else if (right && right->count > BTREE_MIN)
+      bt_borrow_right(parent, i, node, right);
+    else if (left)
+      bt_merge(tree, parent, i - 1, left, node);
+    else
+      bt_merge(tree, parent, i, node, right);
+    node = &parent->hdr;
+  }
+
+  /* shrink from the top */
+  bt_node_t* root = mvoid_get(&tree->root);
+  if (!root->count) {
+    if (root->leaf) {
+      mvoid_set(&tree->root, NULL);
+      mvoid_set(&tree->first, NULL);
+      mvoid_set(&tree->last, NULL);
+    } else {
+      mvoid_set(&tree->root, bt_child((bt_inner_t*) root, 0));
+    }
+    bt_free(tree, root);
+    --tree->height;
+  }
+  return 0;
+}
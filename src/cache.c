@@ -0,0 +1,141 @@
+#include <mitosha.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Blocks of up to MCACHE_CLASSES tags are cached, one magazine per size.
+ * Class c holds blocks of c tags, i.e. c * 16 - sizeof(size_t) payload.
+ */
+#define MCACHE_CLASSES 16
+#define MCACHE_GRAIN 16
+#define MCACHE_MAGAZINE 64
+#define MCACHE_BATCH (MCACHE_MAGAZINE / 2)
+
+typedef struct {
+  size_t count;
+  void* items[MCACHE_MAGAZINE];
+} magazine_t;
+
+struct mcache_s {
+  mpool_t* pool;
+  mshm_t* shm;
+  magazine_t mags[MCACHE_CLASSES + 1];
+};
+
+/* 0 when the lock is held (also after recovering a dead owner), 1 when locking failed */
+static inline int cache_lock(mcache_t* cache) {
+  if (!cache->shm)
+    return 0;
+  int const rc = mshm_lock(cache->shm);
+  if (rc && rc != EOWNERDEAD) {
+    fprintf(stderr, "%s shm lock failed\n", __func__);
+    return 1;
+  }
+  return 0;
+}
+
+static inline void cache_unlock(mcache_t* cache) {
+  if (cache->shm)
+    mshm_unlock(cache->shm);
+}
+
+static inline size_t cache_class(size_t size) {
+  return (size + sizeof(size_t) + MCACHE_GRAIN - 1) / MCACHE_GRAIN;
+}
+
+static inline size_t class_payload(size_t cls) {
+  return cls * MCACHE_GRAIN - sizeof(size_t);
+}
+
+/* return 'count' oldest items of magazine to the pool, caller holds lock */
+static void magazine_drain(mcache_t* cache, magazine_t* mag, size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    mpool_free(cache->pool, mag->items[i]);
+  mag->count -= count;
+  memmove(mag->items, mag->items + count, mag->count * sizeof(void*));
+}
+
+mcache_t* mcache_create(mpool_t* pool, mshm_t* shm) {
+  if (!pool)
+    return NULL;
+  mcache_t* cache = malloc(sizeof(*cache));
+  if (!cache)
+    return NULL;
+  memset(cache, 0, sizeof(*cache));
+  cache->pool = pool;
+  cache->shm = shm;
+  return cache;
+}
+
+void mcache_cleanup(mcache_t* cache) {
+  if (!cache)
+    return;
+  if (mcache_flush(cache))
+    fprintf(stderr, "%s cached blocks not returned to the pool\n", __func__);
+  free(cache);
+}
+
+void* mcache_alloc(mcache_t* cache, size_t size) {
+  size_t const cls = cache_class(size);
+  if (cls > MCACHE_CLASSES) {
+    if (cache_lock(cache))
+      return NULL;
+    void* ptr = mpool_alloc(cache->pool, size);
+    cache_unlock(cache);
+    return ptr;
+  }
+
+  magazine_t* mag = &cache->mags[cls];
+  if (!mag->count) {
+    if (cache_lock(cache))
+      return NULL;
+    while (mag->count < MCACHE_BATCH) {
+      void* ptr = mpool_alloc(cache->pool, class_payload(cls));
+      if (!ptr)
+        break;
+      mag->items[mag->count++] = ptr;
+    }
+    cache_unlock(cache);
+    if (!mag->count)
+      return NULL;
+  }
+  return mag->items[--mag->count];
+}
+
+void mcache_free(mcache_t* cache, void* ptr) {
+  if (!ptr)
+    return;
+
+  size_t const cls = cache_class(mpool_block_size(ptr));
+  if (cls > MCACHE_CLASSES) {
+    if (cache_lock(cache)) {
+      fprintf(stderr, "%s block %p not freed\n", __func__, ptr);
+      return;
+    }
+    mpool_free(cache->pool, ptr);
+    cache_unlock(cache);
+    return;
+  }
+
+  magazine_t* mag = &cache->mags[cls];
+  if (mag->count == MCACHE_MAGAZINE) {
+    if (cache_lock(cache)) {
+      fprintf(stderr, "%s block %p not freed\n", __func__, ptr);
+      return;
+    }
+    magazine_drain(cache, mag, MCACHE_BATCH);
+    cache_unlock(cache);
+  }
+  mag->items[mag->count++] = ptr;
+}
+
+int mcache_flush(mcache_t* cache) {
+  if (cache_lock(cache))
+    return 1;
+  for (size_t cls = 1; cls <= MCACHE_CLASSES; ++cls)
+    magazine_drain(cache, &cache->mags[cls], cache->mags[cls].count);
+  cache_unlock(cache);
+  return 0;
+}
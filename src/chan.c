@@ -0,0 +1,133 @@
+#include <mitosha.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define massert(cond, ...) ((void) ((cond) || (fprintf(stderr, __VA_ARGS__), exit(EXIT_FAILURE), 0)))
+
+/*
+ * Byte ring with free running 64-bit positions. Every message starts with
+ * an 8 byte header holding its size and is padded to 8 bytes, so payloads
+ * stay aligned. A message never wraps: when it does not fit before the end
+ * of the ring the producer writes a wrap header and starts over at offset 0.
+ *
+ * Only the producer writes head and only the consumer writes tail; each
+ * keeps a cached copy of the other index on its own cache line. Message
+ * bytes are published by the release store of head and given back by the
+ * release store of tail.
+ */
+#define MCHAN_LINE 64
+#define MCHAN_ALIGN 8
+#define MCHAN_WRAP UINT64_MAX /* header of the skipped ring end */
+
+struct mchan_s {
+  uint64_t marker;
+  uint64_t mask; /* ring size - 1 */
+  char pad0[MCHAN_LINE - 16];
+  /* producer line */
+  uint64_t head;
+  uint64_t tail_cache;
+  uint64_t wpos; /* header position of the reserved message */
+  uint64_t wlen; /* reserved size */
+  char pad1[MCHAN_LINE - 32];
+  /* consumer line */
+  uint64_t tail;
+  uint64_t head_cache;
+  char pad2[MCHAN_LINE - 16];
+};
+
+static const uint64_t MCHAN_MARKER = 0x4d4348414efafafa; // MCHAN
+
+static inline uint64_t chan_round(uint64_t size) {
+  return (size + MCHAN_ALIGN - 1) & ~(uint64_t) (MCHAN_ALIGN - 1);
+}
+
+static inline uint64_t* chan_header(mchan_t const* chan, uint64_t pos) {
+  return (uint64_t*) ((char*) (chan + 1) + (pos & chan->mask));
+}
+
+mchan_t* mchan_format(void* addr, size_t size) {
+  size_t const min = sizeof(mchan_t) + 2 * MCHAN_ALIGN;
+  if (!addr || size < min) {
+    fprintf(stderr, "%s need %zu or more memory\n", __func__, min);
+    return NULL;
+  }
+  size_t capacity = 2 * MCHAN_ALIGN;
+  while (capacity * 2 <= size - sizeof(mchan_t))
+    capacity *= 2;
+
+  mchan_t* chan = (mchan_t*) addr;
+  memset(chan, 0, sizeof(*chan));
+  chan->mask = capacity - 1;
+  __atomic_store_n(&chan->marker, MCHAN_MARKER, __ATOMIC_RELEASE);
+  return chan;
+}
+
+mchan_t* mchan_attach_existing(void* src) {
+  if (!src)
+    return NULL;
+  mchan_t* chan = (mchan_t*) src;
+  if (__atomic_load_n(&chan->marker, __ATOMIC_ACQUIRE) == MCHAN_MARKER)
+    return chan;
+  fprintf(stderr, "%s invalid MCHAN marker\n", __func__);
+  return NULL;
+}
+
+size_t mchan_capacity(mchan_t const* chan) {
+  return chan->mask + 1;
+}
+
+void* mchan_reserve(mchan_t* chan, size_t size) {
+  uint64_t const capacity = chan->mask + 1;
+  uint64_t const need = sizeof(uint64_t) + chan_round(size);
+  uint64_t const head = chan->head;
+  uint64_t const room = capacity - (head & chan->mask); /* bytes before the ring end */
+  uint64_t const skip = need > room ? room : 0;
+  if (need > capacity / 2)
+    return NULL; /* might never fit behind a wrap */
+
+  if (capacity - (head - chan->tail_cache) < skip + need) {
+    chan->tail_cache = __atomic_load_n(&chan->tail, __ATOMIC_ACQUIRE);
+    if (capacity - (head - chan->tail_cache) < skip + need)
+      return NULL;
+  }
+  if (skip)
+    *chan_header(chan, head) = MCHAN_WRAP; /* published along with the message */
+  chan->wpos = head + skip;
+  chan->wlen = size;
+  return chan_header(chan, chan->wpos) + 1;
+}
+
+void mchan_commit(mchan_t* chan, size_t size) {
+  massert(size <= chan->wlen, "%s commit %zu above reserved %zu\n", __func__, size, (size_t) chan->wlen);
+  *chan_header(chan, chan->wpos) = size;
+  __atomic_store_n(&chan->head, chan->wpos + sizeof(uint64_t) + chan_round(size), __ATOMIC_RELEASE);
+  chan->wlen = 0;
+}
+
+void* mchan_peek(mchan_t* chan, size_t* size) {
+  for (;;) {
+    uint64_t const tail = chan->tail;
+    if (chan->head_cache == tail) {
+      chan->head_cache = __atomic_load_n(&chan->head, __ATOMIC_ACQUIRE);
+      if (chan->head_cache == tail)
+        return NULL;
+    }
+    uint64_t* header = chan_header(chan, tail);
+    if (*header != MCHAN_WRAP) {
+      if (size)
+        *size = *header;
+      return header + 1;
+    }
+    /* give the skipped end back right away */
+    __atomic_store_n(&chan->tail, tail + chan->mask + 1 - (tail & chan->mask), __ATOMIC_RELEASE);
+  }
+}
+
+void mchan_release(mchan_t* chan) {
+  uint64_t const tail = chan->tail;
+  massert(tail != chan->head_cache, "%s nothing to release\n", __func__);
+  uint64_t const size = *chan_header(chan, tail);
+  __atomic_store_n(&chan->tail, tail + sizeof(uint64_t) + chan_round(size), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,60 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <mitosha.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Eventcount in one 64-bit word: the high half is the epoch (the futex
+ * word), the low half counts waiters. Notifiers bump the epoch with one
+ * atomic add and only enter the kernel when the waiter count they replaced
+ * was non-zero. Waiters register with an atomic add as well; if the epoch
+ * moved since mevent_seq they return at once, otherwise a notifier is
+ * bound to see them and wake the futex.
+ */
+#define EVENT_EPOCH_ONE (1ULL << 32)
+#define EVENT_WAITERS 0xffffffffULL
+
+static inline uint32_t* event_futex(mevent_t* event) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return (uint32_t*) &event->state + 1;
+#else
+  return (uint32_t*) &event->state;
+#endif
+}
+
+static void event_notify(mevent_t* event, int count) {
+  uint64_t const prev = __atomic_fetch_add(&event->state, EVENT_EPOCH_ONE, __ATOMIC_ACQ_REL);
+  if (prev & EVENT_WAITERS)
+    syscall(SYS_futex, event_futex(event), FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+uint32_t mevent_seq(mevent_t const* event) {
+  return (uint32_t) (__atomic_load_n(&event->state, __ATOMIC_ACQUIRE) >> 32);
+}
+
+int mevent_wait(mevent_t* event, uint32_t seq, int timeout_ms) {
+  uint64_t const prev = __atomic_fetch_add(&event->state, 1, __ATOMIC_SEQ_CST);
+  int rc = 0;
+  if ((uint32_t) (prev >> 32) == seq) {
+    struct timespec timeout = {timeout_ms / 1000, (long) (timeout_ms % 1000) * 1000000};
+    if (syscall(SYS_futex, event_futex(event), FUTEX_WAIT, seq, timeout_ms >= 0 ? &timeout : NULL, NULL, 0) &&
+        errno == ETIMEDOUT)
+      rc = ETIMEDOUT;
+  }
+  __atomic_sub_fetch(&event->state, 1, __ATOMIC_RELAXED);
+  return rc;
+}
+
+void mevent_notify_one(mevent_t* event) {
+  event_notify(event, 1);
+}
+
+void mevent_notify_all(mevent_t* event) {
+  event_notify(event, INT_MAX);
+}
@@ -0,0 +1,219 @@
+#include <mitosha.h>
+#include <string.h>
+
+/*
+ * Robin Hood open addressing. A slot keeps the full hash next to the
+ * relative node pointer, so probes compare hashes without touching nodes
+ * and the table never needs the hash function again.
+ *
+ * Growing allocates a table of twice the size and moves a few old slots on
+ * every insert/remove; lookups check the new table, then the old one. The
+ * old table only loses entries meanwhile: they turn into tombstones that
+ * keep their hash, so probe distances there stay valid.
+ */
+#define HT_USED (1ULL << 63) /* set in every stored hash, 0 means empty */
+#define HT_MIN_CAPACITY 8
+#define HT_MIGRATE_STEP 8 /* old slots moved per update, finishes long before the new table fills */
+
+typedef struct {
+  uint64_t hash;
+  mvoid_t node; /* NULL with hash set: tombstone (old table only) */
+} ht_slot_t;
+
+static inline ht_slot_t* ht_slots(mvoid_t const* table) {
+  return mvoid_get(table);
+}
+
+static inline uint64_t ht_key(uint64_t hash) {
+  return hash | HT_USED;
+}
+
+static inline size_t ht_dist(ht_slot_t const* slot, size_t pos, size_t mask) {
+  return (pos - (size_t) slot->hash) & mask;
+}
+
+static ht_slot_t* ht_alloc(hashtable_t* table, size_t capacity) {
+  ht_slot_t* slots = mpool_alloc(mvoid_get(&table->pool), capacity * sizeof(ht_slot_t));
+  if (slots)
+    memset(slots, 0, capacity * sizeof(ht_slot_t));
+  return slots;
+}
+
+static ht_slot_t* ht_find(ht_slot_t* slots, size_t mask, hashnode_t const* key, uint64_t hash,
+                          hashtable_equal_f eq) {
+  for (size_t pos = hash & mask, d = 0;; pos = (pos + 1) & mask, ++d) {
+    ht_slot_t* slot = &slots[pos];
+    if (!slot->hash || ht_dist(slot, pos, mask) < d)
+      return NULL;
+    if (slot->hash == hash) {
+      hashnode_t* node = mvoid_get(&slot->node);
+      if (node && eq(node, key))
+        return slot;
+    }
+  }
+}
+
+/* put entry known to be absent, displacing richer entries */
+static void ht_place(ht_slot_t* slots, size_t mask, uint64_t hash, hashnode_t* node) {
+  for (size_t pos = hash & mask, d = 0;; pos = (pos + 1) & mask, ++d) {
+    ht_slot_t* slot = &slots[pos];
+    if (!slot->hash) {
+      slot->hash = hash;
+      mvoid_set(&slot->node, node);
+      return;
+    }
+    size_t const sd = ht_dist(slot, pos, mask);
+    if (sd < d) {
+      uint64_t const h = slot->hash;
+      hashnode_t* n = mvoid_get(&slot->node);
+      slot->hash = hash;
+      mvoid_set(&slot->node, node);
+      hash = h;
+      node = n;
+      d = sd;
+    }
+  }
+}
+
+/* remove from the current table by shifting the following run back */
+static void ht_erase(ht_slot_t* slots, size_t mask, size_t pos) {
+  for (;;) {
+    size_t const next = (pos + 1) & mask;
+    ht_slot_t* slot = &slots[next];
+    if (!slot->hash || !ht_dist(slot, next, mask))
+      break;
+    slots[pos].hash = slot->hash;
+    mvoid_set(&slots[pos].node, mvoid_get(&slot->node));
+    pos = next;
+  }
+  slots[pos].hash = 0;
+  mvoid_set(&slots[pos].node, NULL);
+}
+
+static void ht_migrate(hashtable_t* table) {
+  ht_slot_t* old = ht_slots(&table->old);
+  if (!old)
+    return;
+  ht_slot_t* slots = ht_slots(&table->slots);
+  for (size_t n = 0; n < HT_MIGRATE_STEP && table->migrate <= table->old_mask; ++n, ++table->migrate) {
+    ht_slot_t* slot = &old[table->migrate];
+    hashnode_t* node = mvoid_get(&slot->node);
+    if (node) {
+      ht_place(slots, table->mask, slot->hash, node);
+      mvoid_set(&slot->node, NULL); /* tombstone */
+    }
+  }
+  if (table->migrate > table->old_mask) {
+    mpool_free(mvoid_get(&table->pool), old);
+    mvoid_set(&table->old, NULL);
+    table->old_mask = 0;
+    table->migrate = 0;
+  }
+}
+
+int hashtable_init(hashtable_t* table, mpool_t* pool, size_t hint) {
+  size_t capacity = HT_MIN_CAPACITY;
+  while (capacity * 3 / 4 < hint)
+    capacity *= 2;
+
+  memset(table, 0, sizeof(*table));
+  mvoid_set(&table->pool, pool);
+  ht_slot_t* slots = ht_alloc(table, capacity);
+  mvoid_set(&table->slots, slots);
+  if (!slots)
+    return 1;
+  table->mask = capacity - 1;
+  return 0;
+}
+
+void hashtable_cleanup(hashtable_t* table) {
+  mpool_t* pool = mvoid_get(&table->pool);
+  mpool_free(pool, ht_slots(&table->slots));
+  mpool_free(pool, ht_slots(&table->old));
+  mvoid_set(&table->slots, NULL);
+  mvoid_set(&table->old, NULL);
+  table->count = 0;
+}
+
+size_t hashtable_count(hashtable_t const* table) {
+  return table->count;
+}
+
+hashnode_t* hashtable_lookup(hashtable_t const* table, hashnode_t const* key, uint64_t hash, hashtable_equal_f eq) {
+  hash = ht_key(hash);
+  ht_slot_t* slot = ht_find(ht_slots(&table->slots), table->mask, key, hash, eq);
+  if (!slot && mvoid_get(&table->old))
+    slot = ht_find(ht_slots(&table->old), table->old_mask, key, hash, eq);
+  return slot ? mvoid_get(&slot->node) : NULL;
+}
+
+int hashtable_insert(hashtable_t* table, hashnode_t* node, uint64_t hash, hashtable_equal_f eq) {
+  ht_migrate(table);
+  if (hashtable_lookup(table, node, hash, eq))
+    return 1;
+
+  size_t const capacity = table->mask + 1;
+  if ((table->count + 1) * 4 > capacity * 3 && !mvoid_get(&table->old)) {
+    ht_slot_t* slots = ht_alloc(table, capacity * 2);
+    if (slots) {
+      mvoid_set(&table->old, ht_slots(&table->slots));
+      mvoid_set(&table->slots, slots);
+      table->old_mask = table->mask;
+      table->mask = capacity * 2 - 1;
+      table->migrate = 0;
+      ht_migrate(table);
+    } else if (table->count + 1 >= capacity) {
+      return -1; /* keep one empty slot to end probes */
+    }
+  }
+
+  node->hash = hash;
+  ht_place(ht_slots(&table->slots), table->mask, ht_key(hash), node);
+  ++table->count;
+  return 0;
+}
+
+hashnode_t* hashtable_remove(hashtable_t* table, hashnode_t const* key, uint64_t hash, hashtable_equal_f eq) {
+  ht_migrate(table);
+  hash = ht_key(hash);
+
+  ht_slot_t* slots = ht_slots(&table->slots);
+  ht_slot_t* slot = ht_find(slots, table->mask, key, hash, eq);
+  hashnode_t* node = NULL;
+  if (slot) {
+    node = mvoid_get(&slot->node);
+    ht_erase(slots, table->mask, slot - slots);
+  } else if (mvoid_get(&table->old)) {
+    slot = ht_find(ht_slots(&table->old), table->old_mask, key, hash, eq);
+    if (slot) {
+      node = mvoid_get(&slot->node);
+      mvoid_set(&slot->node, NULL); /* tombstone */
+    }
+  }
+  if (node)
+    --table->count;
+  return node;
+}
+
+hashnode_t* hashtable_next(hashtable_t const* table, size_t* pos) {
+  size_t const capacity = table->mask + 1;
+  ht_slot_t const* slots = ht_slots(&table->slots);
+  for (; *pos < capacity; ++*pos) {
+    hashnode_t* node = mvoid_get(&slots[*pos].node);
+    if (node) {
+      ++*pos;
+      return node;
+    }
+  }
+  ht_slot_t const* old = ht_slots(&table->old);
+  if (!old)
+    return NULL;
+  for (; *pos - capacity <= table->old_mask; ++*pos) {
+    hashnode_t* node = mvoid_get(&old[*pos - capacity].node);
+    if (node) {
+      ++*pos;
+      return node;
+    }
+  }
+  return NULL;
+}
@@ -131,6 +131,23 @@ void list_replace(listnode_t* old, listnode_t* node, list_t* list) {
   NODE_INIT(old);
 }
 
+void list_relocate(listnode_t* node, listnode_t const* old, list_t* list) {
+  ptrdiff_t const delta = (char*) node - (char const*) old;
+  mvoid_rebase(&node->next, delta);
+  mvoid_rebase(&node->prev, delta);
+
+  listnode_t* prev = list_prev(node);
+  listnode_t* next = list_next(node);
+  if (prev)
+    mvoid_set(&prev->next, node);
+  else
+    mvoid_set(&list->first, node);
+  if (next)
+    mvoid_set(&next->prev, node);
+  else
+    mvoid_set(&list->last, node);
+}
+
 void list_swap(listnode_t* node1, listnode_t* node2, list_t* list) {
   listnode_t* p1 = list_prev(node1);
   listnode_t* n1 = list_next(node1);
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <errno.h>
 #include <mitosha.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,9 +9,56 @@
 
 typedef struct tag_s {
   size_t size;
-  mvoid_t next;
+  uint32_t next; /* free bin links (tag indices), valid while the tag is free */
+  uint32_t prev;
 } tag_t;
 
+#define TAG_NIL UINT32_MAX
+#define TAG_PREV_FREE ((size_t) 1) /* set in a used tag whose left neighbour is free */
+#define MPOOL_MAX_TAGS ((size_t) TAG_NIL - 1)
+
+/*
+ * Free tags are kept in TLSF-style segregated bins: the first level splits
+ * sizes by power of two, the second level splits every power of two into
+ * MPOOL_SL_COUNT linear classes. Sizes are measured in tags.
+ */
+#define MPOOL_SL_LOG2 2
+#define MPOOL_SL_COUNT (1U << MPOOL_SL_LOG2)
+#define MPOOL_FL_COUNT 32
+
+/*
+ * Boundary bitmap (one bit per tag, set where a free tag starts) is kept as
+ * 64-bit words plus summary levels: a bit of level N+1 is set when the
+ * matching word of level N is not zero. The top level is a single word.
+ * The bitmap follows the tags, so mpool_extend can move it to the new tail
+ * and hand its old place over to the tags.
+ */
+#define MPOOL_BITS_LEVELS 6
+#define BITS_NONE SIZE_MAX
+
+/*
+ * Hot-path counters (mpool_counters) are only maintained when built with
+ * MPOOL_STATS=1; otherwise the macros vanish. Writers are serialised by the
+ * pool lock, so a relaxed load/store is enough and readers in other
+ * processes never see torn values.
+ */
+#ifndef MPOOL_STATS
+#define MPOOL_STATS 0
+#endif
+
+#if MPOOL_STATS
+#define STAT_ADD(pool, field, n)                                                                                       \
+  __atomic_store_n(&(pool)->counters.field, (pool)->counters.field + (n), __ATOMIC_RELAXED)
+#define STAT_MAX(pool, field, v)                                                                                       \
+  do {                                                                                                                 \
+    if ((uint64_t) (v) > (pool)->counters.field)                                                                       \
+      __atomic_store_n(&(pool)->counters.field, (uint64_t) (v), __ATOMIC_RELAXED);                                     \
+  } while (0)
+#else
+#define STAT_ADD(pool, field, n) ((void) 0)
+#define STAT_MAX(pool, field, v) ((void) 0)
+#endif
+
 static inline void* tag_to_mem(tag_t const* tag) {
   return (void*) &tag->next;
 }
@@ -19,12 +67,8 @@ static inline tag_t* tag_from_mem(void* mem) {
   return (tag_t*) ((char*) mem - sizeof(size_t));
 }
 
-static inline tag_t* tag_next(tag_t* tag) {
-  return (tag_t*) mvoid_get(&tag->next);
-}
-
-static inline void tag_set_next(tag_t* tag, tag_t* next) {
-  mvoid_set(&tag->next, next);
+static inline size_t tag_size(tag_t const* tag) {
+  return tag->size & ~TAG_PREV_FREE;
 }
 
 typedef struct mpool_s {
@@ -32,9 +76,20 @@ typedef struct mpool_s {
   size_t size;
   size_t balance;
   size_t ntags;
+  size_t free_bytes; /* sum of free tag sizes */
+  size_t free_tags;  /* number of free tags */
+  size_t largest;    /* largest free tag size, an upper bound while largest_stale */
+  size_t largest_n;  /* free tags of size 'largest' */
   mvoid_t bits;
   mvoid_t tags;
-  mvoid_t free;
+  uint32_t fl_bitmap;
+  uint8_t sl_bitmap[MPOOL_FL_COUNT];
+  uint32_t bins[MPOOL_FL_COUNT][MPOOL_SL_COUNT];
+  uint32_t nlevels;
+  uint32_t levels[MPOOL_BITS_LEVELS]; /* word offset of each bitmap level */
+  uint32_t largest_stale;             /* the last tag of the largest size was taken */
+  uint32_t counting;                  /* formatted by a MPOOL_STATS build */
+  mpool_counters_t counters;          /* present in every build, see MPOOL_STATS */
 } mpool_t;
 
 static size_t align_size(size_t need) {
@@ -42,43 +97,330 @@ static size_t align_size(size_t need) {
   return ntags * sizeof(tag_t);
 }
 
-static inline size_t bits_size(size_t ntags) {
-  return (ntags + 7) / 8;
+static inline tag_t* tag_at(mpool_t const* pool, uint32_t idx) {
+  if (idx == TAG_NIL)
+    return NULL;
+  return (tag_t*) mvoid_get(&pool->tags) + idx;
+}
+
+static inline uint32_t tag_index(mpool_t const* pool, tag_t const* tag) {
+  return (uint32_t) (tag - (tag_t const*) mvoid_get(&pool->tags));
+}
+
+static inline tag_t* tag_right(tag_t* tag, mpool_t const* pool) {
+  tag_t* right = (tag_t*) ((char*) tag + tag_size(tag));
+  if (right >= (tag_t*) mvoid_get(&pool->tags) + pool->ntags)
+    return NULL;
+  return right;
+}
+
+static inline size_t bits_words(size_t n) {
+  return (n + 63) / 64;
+}
+
+static size_t bits_size(size_t ntags) {
+  size_t words = bits_words(ntags);
+  size_t total = words;
+  while (words > 1)
+    total += (words = bits_words(words));
+  return total * sizeof(uint64_t);
+}
+
+static inline uint64_t* bits_level(mpool_t const* pool, unsigned level) {
+  return (uint64_t*) mvoid_get(&pool->bits) + pool->levels[level];
 }
 
 static inline void bits_set(tag_t* tag, mpool_t* pool) {
-  uint8_t* bits = mvoid_get(&pool->bits);
-  size_t const bit = tag - (tag_t*) mvoid_get(&pool->tags);
-  bits[bit / 8] |= 1U << (bit % 8);
+  size_t bit = tag_index(pool, tag);
+  for (unsigned l = 0; l < pool->nlevels; ++l, bit /= 64) {
+    uint64_t* word = bits_level(pool, l) + bit / 64;
+    uint64_t const old = *word;
+    *word = old | (1ULL << (bit % 64));
+    if (old)
+      break;
+  }
 }
 
 static inline void bits_clear(tag_t* tag, mpool_t* pool) {
-  uint8_t* bits = mvoid_get(&pool->bits);
-  size_t const bit = tag - (tag_t*) mvoid_get(&pool->tags);
-  bits[bit / 8] &= ~(1U << (bit % 8));
+  size_t bit = tag_index(pool, tag);
+  for (unsigned l = 0; l < pool->nlevels; ++l, bit /= 64) {
+    uint64_t* word = bits_level(pool, l) + bit / 64;
+    if ((*word &= ~(1ULL << (bit % 64))))
+      break;
+  }
+}
+
+static inline int bits_test(tag_t const* tag, mpool_t const* pool) {
+  size_t const bit = tag_index(pool, tag);
+  return (bits_level(pool, 0)[bit / 64] >> (bit % 64)) & 1U;
+}
+
+/* highest set bit below 'pos', climbs summary levels instead of scanning; *climbed gets the levels climbed */
+static size_t bits_prev(size_t pos, mpool_t const* pool, unsigned* climbed) {
+  unsigned l = 0;
+  for (;; ++l) {
+    *climbed = l;
+    if (l == pool->nlevels)
+      return BITS_NONE;
+    uint64_t const* words = bits_level(pool, l);
+    size_t const w = pos / 64;
+    uint64_t const mask = (1ULL << (pos % 64)) - 1;
+    uint64_t const m = words[w] & mask;
+    if (m) {
+      pos = w * 64 + 63 - __builtin_clzll(m);
+      break;
+    }
+    if (!w)
+      return BITS_NONE;
+    pos = w;
+  }
+  while (l-- > 0)
+    pos = pos * 64 + 63 - __builtin_clzll(bits_level(pool, l)[pos]);
+  return pos;
+}
+
+/* lowest set bit at or above 'pos' (pos < ntags), mirrors bits_prev */
+static size_t bits_next(size_t pos, mpool_t const* pool) {
+  size_t nwords = bits_words(pool->ntags);
+  unsigned l = 0;
+  for (;; ++l) {
+    uint64_t const* words = bits_level(pool, l);
+    size_t const w = pos / 64;
+    uint64_t const m = words[w] & (~0ULL << (pos % 64));
+    if (m) {
+      pos = w * 64 + __builtin_ctzll(m);
+      break;
+    }
+    if (w + 1 >= nwords)
+      return BITS_NONE;
+    pos = w + 1;
+    nwords = bits_words(nwords);
+  }
+  while (l-- > 0)
+    pos = pos * 64 + __builtin_ctzll(bits_level(pool, l)[pos]);
+  return pos;
 }
 
 static tag_t* tag_left(tag_t* tag, mpool_t* pool) {
-  tag_t* tags = mvoid_get(&pool->tags);
-  uint8_t* bits = mvoid_get(&pool->bits);
-  size_t bit = tag - tags;
-  while (bit-- > 0) {
-    if (bits[bit / 8] & (1U << (bit % 8)))
-      return tags + bit;
+  unsigned climbed;
+  size_t const bit = bits_prev(tag_index(pool, tag), pool, &climbed);
+  STAT_ADD(pool, scans, 1);
+  STAT_ADD(pool, scan_words, 2 * climbed + 1);
+  STAT_MAX(pool, scan_max, 2 * climbed + 1);
+  if (bit == BITS_NONE)
+    return NULL;
+  return (tag_t*) mvoid_get(&pool->tags) + bit;
+}
+
+static inline unsigned msb_index(size_t v) {
+  return (unsigned) (sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(v));
+}
+
+/* map tag count to bin indices */
+static inline void bin_mapping(size_t n, unsigned* fl, unsigned* sl) {
+  if (n < MPOOL_SL_COUNT) {
+    *fl = 0;
+    *sl = (unsigned) n;
+    return;
   }
-  return NULL;
+  unsigned const m = msb_index(n);
+  *fl = m - MPOOL_SL_LOG2 + 1;
+  *sl = (unsigned) (n >> (m - MPOOL_SL_LOG2)) - MPOOL_SL_COUNT;
 }
 
+static void bin_insert(tag_t* tag, mpool_t* pool) {
+  unsigned fl, sl;
+  bin_mapping(tag->size / sizeof(tag_t), &fl, &sl);
+
+  uint32_t const idx = tag_index(pool, tag);
+  uint32_t const head = pool->bins[fl][sl];
+  tag->prev = TAG_NIL;
+  tag->next = head;
+  if (head != TAG_NIL)
+    tag_at(pool, head)->prev = idx;
+  pool->bins[fl][sl] = idx;
+
+  pool->fl_bitmap |= 1U << fl;
+  pool->sl_bitmap[fl] |= 1U << sl;
+
+  pool->free_bytes += tag->size;
+  ++pool->free_tags;
+  if (tag->size > pool->largest) {
+    pool->largest = tag->size;
+    pool->largest_n = 1;
+    pool->largest_stale = 0;
+  } else if (tag->size == pool->largest) {
+    ++pool->largest_n;
+    pool->largest_stale = 0;
+  }
+}
+
+/*
+ * The largest free tag lives in the highest non-empty bin. Taking the last
+ * tag of the largest size only marks the cached value stale (the walk would
+ * make allocation O(n) on pools with many holes); the first reader walks that
+ * one bin and caches the result, later ones are O(1). Readers may share the
+ * pool, so the cache is accessed relaxed: they all store the same values.
+ */
+static size_t bin_largest(mpool_t const* pool) {
+  mpool_t* cache = (mpool_t*) pool;
+  if (!__atomic_load_n(&pool->largest_stale, __ATOMIC_RELAXED))
+    return __atomic_load_n(&pool->largest, __ATOMIC_RELAXED);
+
+  size_t largest = 0, n = 0;
+  if (pool->fl_bitmap) {
+    unsigned const fl = msb_index(pool->fl_bitmap);
+    unsigned const sl = msb_index(pool->sl_bitmap[fl]);
+    for (tag_t const* tag = tag_at(pool, pool->bins[fl][sl]); tag; tag = tag_at(pool, tag->next)) {
+      if (tag->size > largest) {
+        largest = tag->size;
+        n = 0;
+      }
+      n += tag->size == largest;
+    }
+  }
+  __atomic_store_n(&cache->largest, largest, __ATOMIC_RELAXED);
+  __atomic_store_n(&cache->largest_n, n, __ATOMIC_RELAXED);
+  __atomic_store_n(&cache->largest_stale, 0, __ATOMIC_RELAXED);
+  return largest;
+}
+
+static void bin_remove(tag_t* tag, mpool_t* pool) {
+  unsigned fl, sl;
+  bin_mapping(tag->size / sizeof(tag_t), &fl, &sl);
+
+  if (tag->prev != TAG_NIL)
+    tag_at(pool, tag->prev)->next = tag->next;
+  else
+    pool->bins[fl][sl] = tag->next;
+  if (tag->next != TAG_NIL)
+    tag_at(pool, tag->next)->prev = tag->prev;
+
+  if (pool->bins[fl][sl] == TAG_NIL) {
+    pool->sl_bitmap[fl] &= ~(1U << sl);
+    if (!pool->sl_bitmap[fl])
+      pool->fl_bitmap &= ~(1U << fl);
+  }
+
+  pool->free_bytes -= tag->size;
+  --pool->free_tags;
+  if (tag->size == pool->largest && !--pool->largest_n)
+    pool->largest_stale = 1;
+}
+
+/*
+ * Find a free tag of at least 'size' bytes. The request is rounded up to the
+ * next class so that the head of any non-empty bin fits; only when that fails
+ * the request's own class is scanned first-fit (pool close to exhaustion).
+ */
+static tag_t* bin_search(size_t size, mpool_t* pool) {
+  size_t const n = size / sizeof(tag_t);
+  size_t r = n;
+  if (n >= MPOOL_SL_COUNT)
+    r += ((size_t) 1 << (msb_index(n) - MPOOL_SL_LOG2)) - 1;
+
+  unsigned fl, sl;
+  bin_mapping(r, &fl, &sl);
+  if (fl < MPOOL_FL_COUNT) {
+    uint32_t slmap = pool->sl_bitmap[fl] & (~0U << sl);
+    if (!slmap && fl + 1 < MPOOL_FL_COUNT) {
+      uint32_t const flmap = pool->fl_bitmap & (~0U << (fl + 1));
+      if (flmap) {
+        fl = __builtin_ctz(flmap);
+        slmap = pool->sl_bitmap[fl];
+      }
+    }
+    if (slmap) {
+      STAT_ADD(pool, search_probes, 1);
+      STAT_MAX(pool, search_max, 1);
+      return tag_at(pool, pool->bins[fl][__builtin_ctz(slmap)]);
+    }
+  }
+
+  bin_mapping(n, &fl, &sl);
+  size_t probes = 0;
+  tag_t* tag = tag_at(pool, pool->bins[fl][sl]);
+  for (; tag && (++probes, tag->size < size); tag = tag_at(pool, tag->next))
+    ;
+  STAT_ADD(pool, search_probes, probes);
+  STAT_MAX(pool, search_max, probes);
+  (void) probes;
+  return tag;
+}
+
+/* coalesce free tag with its free neighbours and put it into bins */
 static void tag_merge(tag_t* tag, mpool_t* pool) {
-  tag_t* next;
-  while ((next = tag_next(tag))) {
-    if ((char*) next > (char*) tag + tag->size)
-      break;
-    tag->size += next->size;
-    tag_set_next(tag, tag_next(next));
-    bits_clear(next, pool);
+  size_t const prev_free = tag->size & TAG_PREV_FREE;
+  tag->size = tag_size(tag);
+
+  tag_t* right = tag_right(tag, pool);
+  if (right && bits_test(right, pool)) {
+    STAT_ADD(pool, merges_right, 1);
+    bin_remove(right, pool);
+    bits_clear(right, pool);
+    tag->size += right->size;
   }
+
+  tag_t* left = prev_free ? tag_left(tag, pool) : NULL;
+  if (left) {
+    STAT_ADD(pool, merges_left, 1);
+    bin_remove(left, pool);
+    left->size += tag->size;
+    tag = left;
+  } else {
+    if (prev_free)
+      fprintf(stderr, "%s bits error\n", __func__);
+    bits_set(tag, pool);
+  }
+  bin_insert(tag, pool);
+
+  if ((right = tag_right(tag, pool)))
+    right->size |= TAG_PREV_FREE;
+}
+
+static size_t calc_ntags(size_t available) {
+  size_t ntags = available / (sizeof(tag_t) * 8 + 1) * 8 + 8;
+  while (bits_size(ntags) + ntags * sizeof(tag_t) > available)
+    --ntags;
+  return ntags;
+}
+
+/* place the bitmap after 'ntags' tags and compute its level offsets */
+static void bits_layout(mpool_t* pool) {
+  mvoid_set(&pool->bits, (tag_t*) mvoid_get(&pool->tags) + pool->ntags);
+
+  size_t words = bits_words(pool->ntags);
+  pool->nlevels = 1;
+  pool->levels[0] = 0;
+  while (words > 1) {
+    pool->levels[pool->nlevels] = pool->levels[pool->nlevels - 1] + words;
+    words = bits_words(words);
+    ++pool->nlevels;
+  }
+}
+
+static void pool_layout(mpool_t* pool) {
+  mvoid_set(&pool->tags, pool + 1);
+  bits_layout(pool);
+  memset(mvoid_get(&pool->bits), 0, bits_size(pool->ntags));
+
+  pool->fl_bitmap = 0;
+  memset(pool->sl_bitmap, 0, sizeof(pool->sl_bitmap));
+  memset(pool->bins, 0xff, sizeof(pool->bins));
+  pool->balance = 0;
+  pool->free_bytes = 0;
+  pool->free_tags = 0;
+  pool->largest = 0;
+  pool->largest_n = 0;
+  pool->largest_stale = 0;
+
+  if (!pool->ntags)
+    return;
+
+  tag_t* tag = mvoid_get(&pool->tags);
+  tag->size = pool->ntags * sizeof(tag_t);
   bits_set(tag, pool);
+  bin_insert(tag, pool);
 }
 
 size_t mpool_calc_required_size(size_t itemsize, size_t nitem) {
@@ -88,21 +430,27 @@ size_t mpool_calc_required_size(size_t itemsize, size_t nitem) {
 }
 
 size_t mpool_size_stuff(size_t total_memory) {
-  size_t const available = total_memory - mpool_calc_required_size(0, 0);
-  size_t ntags = available / sizeof(tag_t);
-  while (bits_size(ntags) + ntags * sizeof(tag_t) > available)
-    --ntags;
+  size_t const ntags = calc_ntags(total_memory - mpool_calc_required_size(0, 0));
   return total_memory - (ntags * sizeof(tag_t) - sizeof(size_t));
 }
 
-static const size_t MPOOL_MARKER = 0x4d504f4f4cfafafa; // MPOOL
+/* low byte: layout version (0xfa in unversioned pools), bump it with every change of the header or tags */
+#define MPOOL_LAYOUT 3
+static const size_t MPOOL_MARKER = 0x4d504f4f4cfafa00 | MPOOL_LAYOUT; // MPOOL
+#define MPOOL_MAGIC_MASK (~(size_t) 0xff)
 
 mpool_t* mpool_attach_existing(void* src) {
   massert(src, "%s nullptr\n", __func__);
   mpool_t* pool = (mpool_t*) src;
-  if ((pool->marker & MPOOL_MARKER) == MPOOL_MARKER)
+  if (pool->marker == MPOOL_MARKER)
     return pool;
+  if ((pool->marker & MPOOL_MAGIC_MASK) == (MPOOL_MARKER & MPOOL_MAGIC_MASK)) {
+    fprintf(stderr, "%s incompatible MPOOL layout\n", __func__);
+    errno = EPROTO;
+    return NULL;
+  }
   fprintf(stderr, "%s invalid MPOOL marker\n", __func__);
+  errno = EINVAL;
   return NULL;
 }
 
@@ -113,30 +461,69 @@ mpool_t* mpool_format_memory(void* src, size_t size) {
     fprintf(stderr, "%s need %zu or more memory\n", __func__, mpool_calc_required_size(0, 0));
     return NULL;
   }
-  size_t const available = size - mpool_calc_required_size(0, 0);
-  size_t ntags = available / sizeof(tag_t);
-  while (bits_size(ntags) + ntags * sizeof(tag_t) > available)
-    --ntags;
-
+  size_t const ntags = calc_ntags(size - mpool_calc_required_size(0, 0));
+  if (ntags > MPOOL_MAX_TAGS) {
+    fprintf(stderr, "%s %zu bytes exceed the limit of %zu tags\n", __func__, size, MPOOL_MAX_TAGS);
+    return NULL;
+  }
   mpool_t* pool = (mpool_t*) src;
   memset(pool, 0, sizeof(*pool));
   pool->marker = MPOOL_MARKER;
+  pool->counting = MPOOL_STATS;
   pool->size = size;
   pool->ntags = ntags;
+  pool_layout(pool);
 
-  mvoid_set(&pool->bits, pool + 1);
-  uint8_t* bits = mvoid_get(&pool->bits);
-  memset(bits, 0, bits_size(ntags));
+  return pool;
+}
 
-  mvoid_set(&pool->tags, bits + bits_size(ntags));
-  mvoid_set(&pool->free, mvoid_get(&pool->tags));
+int mpool_extend(mpool_t* pool, size_t size) {
+  massert(pool, "%s nullptr\n", __func__);
+  if (size < pool->size) {
+    fprintf(stderr, "%s pool can not shrink\n", __func__);
+    return 1;
+  }
+  size_t const ntags = calc_ntags(size - mpool_calc_required_size(0, 0));
+  if (ntags > MPOOL_MAX_TAGS) {
+    fprintf(stderr, "%s %zu bytes exceed the limit of %zu tags\n", __func__, size, MPOOL_MAX_TAGS);
+    return 1;
+  }
+  size_t const old_ntags = pool->ntags;
+  pool->size = size;
+  if (ntags <= old_ntags)
+    return 0;
 
-  tag_t* tag = mvoid_get(&pool->free);
-  tag->size = ntags * sizeof(tag_t);
-  tag_set_next(tag, NULL);
-  pool->balance = 0;
+  /* is the last tag free, i.e. does the last free tag reach the end */
+  size_t last = BITS_NONE;
+  if (old_ntags) {
+    tag_t const* end = tag_at(pool, (uint32_t) old_ntags - 1);
+    unsigned climbed;
+    last = bits_test(end, pool) ? old_ntags - 1 : bits_prev(old_ntags - 1, pool, &climbed);
+  }
+  int const tail_free = last != BITS_NONE && last + tag_at(pool, last)->size / sizeof(tag_t) == old_ntags;
 
-  return pool;
+  /* move boundary bits to the new tail (overlaps the old bitmap), rebuild summaries */
+  uint64_t const* old_bits = bits_level(pool, 0);
+  size_t const old_words = bits_words(old_ntags);
+  pool->ntags = ntags;
+  bits_layout(pool);
+  uint64_t* bits = mvoid_get(&pool->bits);
+  memmove(bits, old_bits, old_words * sizeof(uint64_t));
+  memset(bits + old_words, 0, bits_size(ntags) - old_words * sizeof(uint64_t));
+  for (unsigned l = 1; l < pool->nlevels; ++l) {
+    uint64_t const* lower = bits_level(pool, l - 1);
+    uint64_t* upper = bits_level(pool, l);
+    for (size_t w = 0, n = pool->levels[l] - pool->levels[l - 1]; w < n; ++w) {
+      if (lower[w])
+        upper[w / 64] |= 1ULL << (w % 64);
+    }
+  }
+
+  /* the new space (with the old bitmap area) is released as one free tag */
+  tag_t* tail = tag_at(pool, (uint32_t) old_ntags);
+  tail->size = (ntags - old_ntags) * sizeof(tag_t) | (tail_free ? TAG_PREV_FREE : 0);
+  tag_merge(tail, pool);
+  return 0;
 }
 
 void mpool_cleanup(mpool_t* src) {
@@ -146,17 +533,7 @@ void mpool_cleanup(mpool_t* src) {
 
 void mpool_reset(mpool_t* pool) {
   massert(pool, "%s nullptr\n", __func__);
-  mvoid_set(&pool->bits, pool + 1);
-  uint8_t* bits = mvoid_get(&pool->bits);
-  memset(bits, 0, bits_size(pool->ntags));
-
-  mvoid_set(&pool->tags, bits + bits_size(pool->ntags));
-  mvoid_set(&pool->free, mvoid_get(&pool->tags));
-
-  tag_t* tag = mvoid_get(&pool->free);
-  tag->size = pool->ntags * sizeof(tag_t);
-  tag_set_next(tag, NULL);
-  pool->balance = 0;
+  pool_layout(pool);
 }
 
 size_t mpool_total_size(mpool_t const* pool) {
@@ -185,85 +562,163 @@ double mpool_utilization(mpool_t const* pool) {
 
 size_t mpool_free_space(mpool_t const* pool) {
   massert(pool, "%s nullptr\n", __func__);
-  size_t avail = 0;
-  for (tag_t* tag = mvoid_get(&pool->free); tag; tag = tag_next(tag))
-    avail += tag->size - sizeof(size_t);
-  return avail;
+  return pool->free_bytes - pool->free_tags * sizeof(size_t);
+}
+
+void mpool_stats(mpool_t const* pool, mpool_stats_t* stats) {
+  massert(pool && stats, "%s nullptr\n", __func__);
+  stats->total_size = pool->size;
+  stats->capacity = mpool_total_capacity(pool);
+  stats->used = pool->balance;
+  stats->free = mpool_free_space(pool);
+  stats->free_blocks = pool->free_tags;
+  size_t const largest = bin_largest(pool);
+  stats->largest_free = largest ? largest - sizeof(size_t) : 0;
+}
+
+int mpool_counters(mpool_t const* pool, mpool_counters_t* counters) {
+  massert(pool && counters, "%s nullptr\n", __func__);
+  uint64_t const* src = (uint64_t const*) &pool->counters;
+  uint64_t* dst = (uint64_t*) counters;
+  for (size_t i = 0; i < sizeof(*counters) / sizeof(uint64_t); ++i)
+    dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+  return pool->counting ? 0 : 1;
+}
+
+void mpool_counters_reset(mpool_t* pool) {
+  massert(pool, "%s nullptr\n", __func__);
+  uint64_t* dst = (uint64_t*) &pool->counters;
+  for (size_t i = 0; i < sizeof(pool->counters) / sizeof(uint64_t); ++i)
+    __atomic_store_n(&dst[i], 0, __ATOMIC_RELAXED);
+}
+
+int mpool_next_block(mpool_t const* pool, size_t* pos, mpool_block_t* block) {
+  massert(pool && pos && block, "%s nullptr\n", __func__);
+  if (*pos >= pool->ntags)
+    return 0;
+  tag_t const* tag = tag_at(pool, (uint32_t) *pos);
+  size_t const size = tag_size(tag);
+  if (size < sizeof(tag_t) || size % sizeof(tag_t) || size / sizeof(tag_t) > pool->ntags - *pos)
+    return 0;
+  block->ptr = tag_to_mem(tag);
+  block->size = size - sizeof(size_t);
+  block->used = !bits_test(tag, pool);
+  *pos += size / sizeof(tag_t);
+  return 1;
+}
+
+int mpool_histogram(mpool_t const* pool, mpool_histogram_t* hist) {
+  massert(pool && hist, "%s nullptr\n", __func__);
+  memset(hist, 0, sizeof(*hist));
+
+  size_t pos = 0;
+  mpool_block_t block;
+  while (mpool_next_block(pool, &pos, &block)) {
+    unsigned const b = msb_index(block.size);
+    if (block.used) {
+      ++hist->used_count[b];
+      hist->used_bytes[b] += block.size;
+      ++hist->used_blocks;
+      hist->used += block.size;
+    } else {
+      ++hist->free_count[b];
+      hist->free_bytes[b] += block.size;
+      ++hist->free_blocks;
+      hist->free += block.size;
+      if (block.size > hist->largest_free)
+        hist->largest_free = block.size;
+    }
+  }
+  if (hist->free)
+    hist->fragmentation = 1.0 - (double) hist->largest_free / (double) hist->free;
+  return pos == pool->ntags ? 0 : 1;
 }
 
 void* mpool_alloc(mpool_t* pool, size_t size) {
   massert(pool, "%s nullptr\n", __func__);
+  STAT_ADD(pool, allocs, 1);
+  if (size > pool->ntags * sizeof(tag_t)) {
+    STAT_ADD(pool, alloc_failed, 1);
+    return NULL;
+  }
   size_t const aligned = align_size(size);
 
-  tag_t* prev = NULL;
-  tag_t* tag = mvoid_get(&pool->free);
-  while (tag && tag->size < aligned) {
-    prev = tag;
-    tag = tag_next(tag);
-  }
-  if (!tag)
+  STAT_ADD(pool, searches, 1);
+  tag_t* tag = bin_search(aligned, pool);
+  if (!tag) {
+    STAT_ADD(pool, alloc_failed, 1);
     return NULL;
+  }
+
+  bin_remove(tag, pool);
+  bits_clear(tag, pool);
 
   if (tag->size > aligned) {
     tag_t* n = (tag_t*) ((char*) tag + aligned);
     n->size = tag->size - aligned;
     tag->size = aligned;
-    tag_set_next(n, tag_next(tag));
-    tag_set_next(tag, n);
-    tag_merge(n, pool);
+    bits_set(n, pool);
+    bin_insert(n, pool);
+  } else {
+    tag_t* right = tag_right(tag, pool);
+    if (right)
+      right->size &= ~TAG_PREV_FREE;
   }
 
-  if (prev)
-    tag_set_next(prev, tag_next(tag));
-  else
-    mvoid_set(&pool->free, tag_next(tag));
-
-  bits_clear(tag, pool);
   pool->balance += aligned;
   return tag_to_mem(tag);
 }
 
 void* mpool_realloc(mpool_t* pool, void* ptr, size_t new_size) {
   massert(pool, "%s nullptr\n", __func__);
+  STAT_ADD(pool, reallocs, 1);
   if (!ptr)
     return mpool_alloc(pool, new_size);
+  if (new_size > pool->ntags * sizeof(tag_t)) {
+    STAT_ADD(pool, alloc_failed, 1);
+    return NULL;
+  }
 
   size_t const aligned = align_size(new_size);
   tag_t* tag = tag_from_mem(ptr);
 
-  if (aligned == tag->size)
+  size_t const size = tag_size(tag);
+  if (aligned == size)
     return ptr;
 
-  if (aligned < tag->size) {
-    size_t const shrink = tag->size - aligned;
+  if (aligned < size) {
+    size_t const shrink = size - aligned;
     if (pool->balance < shrink) {
       fprintf(stderr, "%s pool balance error\n", __func__);
       return NULL;
     }
     pool->balance -= shrink;
-    tag->size = aligned;
+    tag->size = aligned | (tag->size & TAG_PREV_FREE);
 
     tag_t* n = (tag_t*) ((char*) tag + aligned);
     n->size = shrink;
+    tag_merge(n, pool);
+    return ptr;
+  }
 
-    tag_t* head = mvoid_get(&pool->free);
-    if (!head || head > n) {
-      mvoid_set(&pool->free, n);
-      tag_set_next(n, head);
-      tag_merge(n, pool);
-      return ptr;
+  /* grow in place by absorbing a free right neighbour */
+  tag_t* right = tag_right(tag, pool);
+  if (right && bits_test(right, pool) && size + right->size >= aligned) {
+    size_t const total = size + right->size;
+    bin_remove(right, pool);
+    bits_clear(right, pool);
+    tag->size = aligned | (tag->size & TAG_PREV_FREE);
+
+    if (total > aligned) {
+      tag_t* n = (tag_t*) ((char*) tag + aligned);
+      n->size = total - aligned;
+      bits_set(n, pool);
+      bin_insert(n, pool);
+    } else if ((right = tag_right(tag, pool))) {
+      right->size &= ~TAG_PREV_FREE;
     }
 
-    tag_t* left = tag_left(tag, pool);
-    if (!left) {
-      fprintf(stderr, "%s bits error\n", __func__);
-      return NULL;
-    }
-
-    tag_set_next(n, tag_next(left));
-    tag_set_next(left, n);
-    tag_merge(n, pool);
-    tag_merge(left, pool);
+    pool->balance += aligned - size;
     return ptr;
   }
 
@@ -271,11 +726,16 @@ void* mpool_realloc(mpool_t* pool, void* ptr, size_t new_size) {
   if (!np)
     return NULL;
 
-  memcpy(np, ptr, tag->size - sizeof(size_t));
+  memcpy(np, ptr, size - sizeof(size_t));
   mpool_free(pool, ptr);
   return np;
 }
 
+size_t mpool_block_size(void const* ptr) {
+  massert(ptr, "%s nullptr\n", __func__);
+  return tag_size(tag_from_mem((void*) ptr)) - sizeof(size_t);
+}
+
 void* mpool_zalloc(mpool_t* pool, size_t size) {
   massert(pool, "%s nullptr\n", __func__);
   void* ptr = mpool_alloc(pool, size);
@@ -289,29 +749,64 @@ void mpool_free(mpool_t* pool, void* ptr) {
     return;
 
   tag_t* tag = tag_from_mem(ptr);
-  if (pool->balance < tag->size) {
+  if (pool->balance < tag_size(tag)) {
     fprintf(stderr, "%s pool balance error\n", __func__);
     return;
   }
-  pool->balance -= tag->size;
+  STAT_ADD(pool, frees, 1);
+  pool->balance -= tag_size(tag);
+  tag_merge(tag, pool);
+}
 
-  tag_t* head = mvoid_get(&pool->free);
-  if (!head || head > tag) {
-    tag_set_next(tag, head);
-    tag_merge(tag, pool);
-    mvoid_set(&pool->free, tag);
-    return;
-  }
+/*
+ * Compaction step: the allocated block right of a free hole slides down to
+ * the hole start and the hole reappears behind it, merged with whatever free
+ * tag follows. The hole thus bubbles to the pool end collecting free space;
+ * every step costs one bitmap search plus one copy. A pinned block is
+ * stepped over and leaves its hole behind.
+ */
+int mpool_compact(mpool_t* pool, size_t* cursor, size_t budget, mpool_relocate_f relocate, void* arg) {
+  massert(pool && cursor && relocate, "%s nullptr\n", __func__);
+  size_t work = 0; /* bytes moved, a pinned block counts as one tag */
+  while (*cursor < pool->ntags) {
+    size_t const bit = bits_next(*cursor, pool);
+    if (bit == BITS_NONE) {
+      *cursor = pool->ntags;
+      break;
+    }
+    tag_t* hole = tag_at(pool, (uint32_t) bit);
+    tag_t* used = tag_right(hole, pool);
+    if (!used) {
+      *cursor = pool->ntags;
+      break;
+    }
+    size_t const size = tag_size(used);
+    if (work && work + size > budget) {
+      *cursor = bit;
+      return 1;
+    }
+    void* old = tag_to_mem(used);
+    if (relocate(NULL, old, size - sizeof(size_t), arg)) {
+      work += sizeof(tag_t);
+      *cursor = tag_index(pool, used) + size / sizeof(tag_t);
+      continue;
+    }
 
-  tag_t* left = tag_left(tag, pool);
-  if (!left) {
-    fprintf(stderr, "%s bits error\n", __func__);
-    return;
+    size_t const gap = hole->size;
+    bin_remove(hole, pool);
+    bits_clear(hole, pool);
+    memmove(tag_to_mem(hole), old, size - sizeof(size_t));
+    hole->size = size;
+
+    tag_t* tail = (tag_t*) ((char*) hole + size);
+    tail->size = gap;
+    tag_merge(tail, pool);
+
+    relocate(tag_to_mem(hole), old, size - sizeof(size_t), arg);
+    work += size;
+    *cursor = tag_index(pool, tail);
   }
-  tag_set_next(tag, tag_next(left));
-  tag_set_next(left, tag);
-  tag_merge(tag, pool);
-  tag_merge(left, pool);
+  return 0;
 }
 
 void* mpool_memdup(mpool_t* pool, void const* src, size_t size) {
@@ -334,14 +829,20 @@ void mpool_dump(mpool_t const* pool) {
   fprintf(stderr, "Payload capacity: %zu bytes\n", mpool_total_capacity(pool));
   fprintf(stderr, "Used space     : %zu bytes\n", mpool_used(pool));
   fprintf(stderr, "Free space     : %zu bytes\n", mpool_free_space(pool));
+  fprintf(stderr, "Free blocks    : %zu\n", pool->free_tags);
+  fprintf(stderr, "Largest free   : %zu bytes\n", bin_largest(pool));
   fprintf(stderr, "Utilization    : %.2f%%\n", mpool_utilization(pool) * 100.0);
 
-  fprintf(stderr, "\nFree list:\n");
+  mpool_histogram_t hist;
+  if (mpool_histogram(pool, &hist))
+    fprintf(stderr, "Block walk     : does not reach the pool end\n");
+  fprintf(stderr, "Fragmentation  : %.2f%%\n", hist.fragmentation * 100.0);
 
-  tag_t const* tag = mvoid_get(&pool->free);
-  while (tag) {
-    fprintf(stderr, "  [tag: %p] size: %zu bytes\n", (void*) tag, tag->size);
-    tag = tag_next((tag_t*) tag);
+  fprintf(stderr, "\nBlock sizes     %12s %14s %12s %14s\n", "free", "free bytes", "used", "used bytes");
+  for (unsigned b = 0; b < MPOOL_HIST_BUCKETS; ++b) {
+    if (hist.free_count[b] || hist.used_count[b])
+      fprintf(stderr, "  [2^%-2u, 2^%-2u) %12zu %14zu %12zu %14zu\n", b, b + 1, hist.free_count[b], hist.free_bytes[b],
+              hist.used_count[b], hist.used_bytes[b]);
   }
 
   fprintf(stderr, "==================\n\n");
@@ -0,0 +1,368 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <mitosha.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Bounded ring of fixed-size slots. Indices are free running 64-bit
+ * counters masked into the slot array, so they never wrap in practice.
+ *
+ * SPSC: head is written by the producer only and tail by the consumer
+ * only; each side keeps a cached copy of the other index on its own line
+ * and reloads it only when the cache says full/empty. A batch is copied
+ * and then published with one store.
+ *
+ * MPMC (D. Vyukov's bounded queue): each slot carries a sequence number
+ * telling whether it is free for position pos (seq == pos) or holds the
+ * element of pos (seq == pos + 1). Producers and consumers claim positions
+ * by CAS on head/tail and publish through the slot sequence.
+ *
+ * Waiting uses a word per direction packed like mevent_t: the high half
+ * is an epoch (the futex, not private as the ring is shared between
+ * processes), the low half counts waiters. Elements and free slots are
+ * published with release stores and the publisher reads the waiter count
+ * relaxed, so the hot path has no full barrier. The epoch bump and the
+ * system call only happen when somebody waits. The StoreLoad ordering is
+ * paid by the waiter alone: it registers with a seq_cst RMW and re-checks
+ * the ring. A publisher whose count load overtook its own store may still
+ * miss a waiter registering at that moment, so waiters sleep in slices
+ * (RING_SLICE_NS doubling up to RING_SLICE_MAX_NS) and re-check; such a
+ * wake-up is late by one slice at worst, never lost.
+ */
+#define MRING_LINE 64
+
+struct mring_s {
+  uint64_t marker;
+  uint32_t flags;
+  uint32_t elem_size;
+  uint64_t mask;   /* capacity - 1 */
+  uint64_t stride; /* bytes per slot */
+  char pad0[MRING_LINE - 32];
+  /* producer line */
+  uint64_t head;
+  uint64_t tail_cache; /* SPSC producer's copy of tail */
+  char pad1[MRING_LINE - 16];
+  /* consumer line */
+  uint64_t tail;
+  uint64_t head_cache; /* SPSC consumer's copy of head */
+  char pad2[MRING_LINE - 16];
+  /* wait line: epoch (high half) and waiter count of each direction */
+  uint64_t not_empty;
+  uint64_t not_full;
+  char pad3[MRING_LINE - 16];
+};
+
+static const uint64_t MRING_MARKER = 0x4d52494e47fafa02; // MRING, layout 2
+
+#define MRING_ALIGN sizeof(uint64_t)
+
+static inline size_t ring_stride(size_t elem_size, unsigned flags) {
+  size_t const size = (elem_size + MRING_ALIGN - 1) & ~(MRING_ALIGN - 1);
+  return flags & MRING_MPMC ? size + sizeof(uint64_t) : size;
+}
+
+static inline char* ring_slot(mring_t const* ring, uint64_t pos) {
+  return (char*) (ring + 1) + (pos & ring->mask) * ring->stride;
+}
+
+/* MPMC slot: sequence number followed by the element */
+static inline uint64_t* ring_seq(char* slot) {
+  return (uint64_t*) slot;
+}
+
+static inline char* ring_elem(char* slot) {
+  return slot + sizeof(uint64_t);
+}
+
+size_t mring_calc_required_size(size_t capacity, size_t elem_size, unsigned flags) {
+  return sizeof(mring_t) + capacity * ring_stride(elem_size, flags);
+}
+
+mring_t* mring_format(void* addr, size_t size, size_t elem_size, unsigned flags) {
+  if (!elem_size || elem_size > UINT32_MAX) {
+    fprintf(stderr, "%s invalid element size %zu\n", __func__, elem_size);
+    return NULL;
+  }
+  size_t const stride = ring_stride(elem_size, flags);
+  if (!addr || size < sizeof(mring_t) + 2 * stride) {
+    fprintf(stderr, "%s need %zu or more memory\n", __func__, sizeof(mring_t) + 2 * stride);
+    return NULL;
+  }
+  size_t capacity = 2;
+  while (capacity * 2 <= (size - sizeof(mring_t)) / stride)
+    capacity *= 2;
+
+  mring_t* ring = (mring_t*) addr;
+  memset(ring, 0, sizeof(*ring));
+  ring->flags = flags;
+  ring->elem_size = (uint32_t) elem_size;
+  ring->mask = capacity - 1;
+  ring->stride = stride;
+  if (flags & MRING_MPMC)
+    for (uint64_t pos = 0; pos < capacity; ++pos)
+      *ring_seq(ring_slot(ring, pos)) = pos;
+  __atomic_store_n(&ring->marker, MRING_MARKER, __ATOMIC_RELEASE);
+  return ring;
+}
+
+mring_t* mring_attach_existing(void* src) {
+  if (!src)
+    return NULL;
+  mring_t* ring = (mring_t*) src;
+  if (__atomic_load_n(&ring->marker, __ATOMIC_ACQUIRE) == MRING_MARKER)
+    return ring;
+  fprintf(stderr, "%s invalid MRING marker\n", __func__);
+  return NULL;
+}
+
+size_t mring_capacity(mring_t const* ring) {
+  return ring->mask + 1;
+}
+
+size_t mring_elem_size(mring_t const* ring) {
+  return ring->elem_size;
+}
+
+size_t mring_count(mring_t const* ring) {
+  uint64_t const tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  uint64_t const head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (head <= tail)
+    return 0;
+  return head - tail > ring->mask ? ring->mask + 1 : head - tail;
+}
+
+/*---------------------------------------------------------------------------*/
+/* futex wait/wake */
+
+#define RING_EPOCH_ONE (1ULL << 32)
+#define RING_WAITERS 0xffffffffULL
+
+static inline uint32_t* ring_futex(uint64_t* word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return (uint32_t*) word + 1;
+#else
+  return (uint32_t*) word;
+#endif
+}
+
+#define RING_SLICE_NS 50000L         /* first sleep of a waiter */
+#define RING_SLICE_MAX_NS 100000000L /* idle waiters re-check 10 times per second */
+
+/* wake up to n waiters; the release RMW on the epoch makes the publish visible to them */
+static void ring_wake(uint64_t* word, size_t n) {
+  if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & RING_WAITERS))
+    return;
+  __atomic_add_fetch(word, RING_EPOCH_ONE, __ATOMIC_RELEASE);
+  syscall(SYS_futex, ring_futex(word), FUTEX_WAKE, n < INT_MAX ? (int) n : INT_MAX, NULL, NULL, 0);
+}
+
+static void ring_deadline(struct timespec* deadline, long long timeout_ns) {
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += timeout_ns / 1000000000;
+  deadline->tv_nsec += (long) (timeout_ns % 1000000000);
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_nsec -= 1000000000;
+    ++deadline->tv_sec;
+  }
+}
+
+/* sleep while the epoch of word is seq, at most one slice; return ETIMEDOUT once the deadline passed */
+static int ring_sleep(uint64_t* word, uint32_t seq, struct timespec const* deadline, long slice_ns) {
+  struct timespec until;
+  ring_deadline(&until, slice_ns);
+  int const last = deadline && (deadline->tv_sec < until.tv_sec ||
+                                (deadline->tv_sec == until.tv_sec && deadline->tv_nsec <= until.tv_nsec));
+  long const rc = syscall(SYS_futex, ring_futex(word), FUTEX_WAIT_BITSET, seq, last ? deadline : &until, NULL,
+                          FUTEX_BITSET_MATCH_ANY);
+  return rc && errno == ETIMEDOUT && last ? ETIMEDOUT : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* single producer, single consumer */
+
+static void ring_copy_in(mring_t* ring, uint64_t pos, char const* src, size_t n) {
+  size_t const elem = ring->elem_size;
+  if (ring->stride == elem) {
+    /* contiguous slots: at most two copies around the wrap */
+    size_t const first = ring->mask + 1 - (pos & ring->mask);
+    size_t const k = n < first ? n : first;
+    memcpy(ring_slot(ring, pos), src, k * elem);
+    if (n > k)
+      memcpy(ring_slot(ring, 0), src + k * elem, (n - k) * elem);
+    return;
+  }
+  for (size_t i = 0; i < n; ++i)
+    memcpy(ring_slot(ring, pos + i), src + i * elem, elem);
+}
+
+static void ring_copy_out(mring_t const* ring, uint64_t pos, char* dst, size_t n) {
+  size_t const elem = ring->elem_size;
+  if (ring->stride == elem) {
+    size_t const first = ring->mask + 1 - (pos & ring->mask);
+    size_t const k = n < first ? n : first;
+    memcpy(dst, ring_slot(ring, pos), k * elem);
+    if (n > k)
+      memcpy(dst + k * elem, ring_slot(ring, 0), (n - k) * elem);
+    return;
+  }
+  for (size_t i = 0; i < n; ++i)
+    memcpy(dst + i * elem, ring_slot(ring, pos + i), elem);
+}
+
+static size_t spsc_enqueue(mring_t* ring, void const* src, size_t n) {
+  uint64_t const capacity = ring->mask + 1;
+  uint64_t const head = ring->head;
+  if (capacity - (head - ring->tail_cache) < n)
+    ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  uint64_t const space = capacity - (head - ring->tail_cache);
+  if (n > space)
+    n = space;
+  if (!n)
+    return 0;
+  ring_copy_in(ring, head, src, n);
+  __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+static size_t spsc_dequeue(mring_t* ring, void* dst, size_t n) {
+  uint64_t const tail = ring->tail;
+  if (ring->head_cache - tail < n)
+    ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t const avail = ring->head_cache - tail;
+  if (n > avail)
+    n = avail;
+  if (!n)
+    return 0;
+  ring_copy_out(ring, tail, dst, n);
+  __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+/*---------------------------------------------------------------------------*/
+/* multiple producers and consumers */
+
+static int mpmc_push(mring_t* ring, void const* src) {
+  uint64_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  for (;;) {
+    char* slot = ring_slot(ring, pos);
+    int64_t const diff = (int64_t) (__atomic_load_n(ring_seq(slot), __ATOMIC_ACQUIRE) - pos);
+    if (!diff) {
+      if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        memcpy(ring_elem(slot), src, ring->elem_size);
+        __atomic_store_n(ring_seq(slot), pos + 1, __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0; /* slot still holds the element of pos - capacity */
+    } else {
+      pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static int mpmc_pop(mring_t* ring, void* dst) {
+  uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    char* slot = ring_slot(ring, pos);
+    int64_t const diff = (int64_t) (__atomic_load_n(ring_seq(slot), __ATOMIC_ACQUIRE) - (pos + 1));
+    if (!diff) {
+      if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        memcpy(dst, ring_elem(slot), ring->elem_size);
+        __atomic_store_n(ring_seq(slot), pos + ring->mask + 1, __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0; /* element of pos not published yet */
+    } else {
+      pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static size_t ring_enqueue(mring_t* ring, void const* src, size_t n) {
+  if (!(ring->flags & MRING_MPMC))
+    return spsc_enqueue(ring, src, n);
+  size_t k = 0;
+  for (char const* p = src; k < n && mpmc_push(ring, p); ++k, p += ring->elem_size)
+    ;
+  return k;
+}
+
+static size_t ring_dequeue(mring_t* ring, void* dst, size_t n) {
+  if (!(ring->flags & MRING_MPMC))
+    return spsc_dequeue(ring, dst, n);
+  size_t k = 0;
+  for (char* p = dst; k < n && mpmc_pop(ring, p); ++k, p += ring->elem_size)
+    ;
+  return k;
+}
+
+size_t mring_enqueue(mring_t* ring, void const* src, size_t n) {
+  size_t const k = ring_enqueue(ring, src, n);
+  if (k)
+    ring_wake(&ring->not_empty, k);
+  return k;
+}
+
+size_t mring_dequeue(mring_t* ring, void* dst, size_t n) {
+  size_t const k = ring_dequeue(ring, dst, n);
+  if (k)
+    ring_wake(&ring->not_full, k);
+  return k;
+}
+
+size_t mring_enqueue_wait(mring_t* ring, void const* src, size_t n, int timeout_ms) {
+  struct timespec deadline;
+  if (timeout_ms >= 0)
+    ring_deadline(&deadline, timeout_ms * 1000000LL);
+  size_t k = mring_enqueue(ring, src, n);
+  if (k || !n)
+    return k;
+
+  /* register, then recheck: the RMW orders both, publishers after it see us */
+  __atomic_fetch_add(&ring->not_full, 1, __ATOMIC_SEQ_CST);
+  int rc = 0;
+  for (long slice = RING_SLICE_NS;; slice = slice < RING_SLICE_MAX_NS / 2 ? 2 * slice : RING_SLICE_MAX_NS) {
+    uint32_t const seq = (uint32_t) (__atomic_load_n(&ring->not_full, __ATOMIC_ACQUIRE) >> 32);
+    if ((k = ring_enqueue(ring, src, n)) || rc == ETIMEDOUT)
+      break;
+    rc = ring_sleep(&ring->not_full, seq, timeout_ms >= 0 ? &deadline : NULL, slice);
+  }
+  __atomic_sub_fetch(&ring->not_full, 1, __ATOMIC_RELAXED);
+  if (k)
+    ring_wake(&ring->not_empty, k);
+  return k;
+}
+
+size_t mring_dequeue_wait(mring_t* ring, void* dst, size_t n, int timeout_ms) {
+  struct timespec deadline;
+  if (timeout_ms >= 0)
+    ring_deadline(&deadline, timeout_ms * 1000000LL);
+  size_t k = mring_dequeue(ring, dst, n);
+  if (k || !n)
+    return k;
+
+  __atomic_fetch_add(&ring->not_empty, 1, __ATOMIC_SEQ_CST);
+  int rc = 0;
+  for (long slice = RING_SLICE_NS;; slice = slice < RING_SLICE_MAX_NS / 2 ? 2 * slice : RING_SLICE_MAX_NS) {
+    uint32_t const seq = (uint32_t) (__atomic_load_n(&ring->not_empty, __ATOMIC_ACQUIRE) >> 32);
+    if ((k = ring_dequeue(ring, dst, n)) || rc == ETIMEDOUT)
+      break;
+    rc = ring_sleep(&ring->not_empty, seq, timeout_ms >= 0 ? &deadline : NULL, slice);
+  }
+  __atomic_sub_fetch(&ring->not_empty, 1, __ATOMIC_RELAXED);
+  if (k)
+    ring_wake(&ring->not_full, k);
+  return k;
+}
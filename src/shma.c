@@ -1,8 +1,12 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <mitosha.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -11,7 +15,39 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <semaphore.h>
+#include <pthread.h>
+
+#define SHM_MAGIC 0x4d53484dU /* MSHM */
+#define SHM_VERSION 3         /* bumped on incompatible header changes */
+#define SHM_SPIN 100
+#define SHM_INIT_WAIT 1000 /* ms to wait for the creator to publish the header */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define shm_relax() __builtin_ia32_pause()
+#else
+#define shm_relax() ((void) 0)
+#endif
+
+/* segment header, lives at offset 0 of every mapping */
+struct shm_header_s {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;        /* MSHM_* creation flags */
+  int32_t numa_policy;   /* MSHM_NUMA_* policy of all pages, grown ones too */
+  uint64_t numa_nodes;
+  uint64_t generation;   /* bumped on every size change */
+  size_t length;         /* user memory size */
+  pthread_mutex_t mutex; /* segment lock for MSHM_MUTEX */
+  pthread_rwlock_t rwlock;
+  mevent_t event; /* mshm_wait/mshm_notify */
+};
+
+/* user memory starts at the first cache line after the header */
+#define SHM_HEADER_SIZE ((sizeof(struct shm_header_s) + 63) & ~(size_t) 63)
 
 struct shma_s {
   int owner;
@@ -19,6 +55,11 @@ struct shma_s {
   size_t length;
   sem_t* sem;
   int fd;
+  int hugetlb;   /* file lives in MSHM_HUGETLBFS */
+  size_t pagesz; /* mapping granularity */
+  size_t maplen;
+  uint64_t generation; /* header generation of this mapping */
+  void* map;
   void* mem;
 };
 
@@ -26,45 +67,321 @@ static void build_shm_name(char const* name, char* out, size_t out_size) {
   snprintf(out, out_size, "/%s", name);
 }
 
+static void build_hugetlb_name(char const* name, char* out, size_t out_size) {
+  snprintf(out, out_size, "%s/%s", MSHM_HUGETLBFS, name);
+}
+
+/* room for "/sem_" and the longest name */
+#define SHM_SEM_NAME_MAX (NAME_MAX + sizeof("/sem_"))
+
 static void build_sem_name(char const* name, char* out, size_t out_size) {
   snprintf(out, out_size, "/sem_%s", name);
 }
 
+static inline struct shm_header_s* shm_header(struct shma_s const* shma) {
+  return (struct shm_header_s*) shma->map;
+}
+
+static int shm_mutex_init(pthread_mutex_t* mutex) {
+  pthread_mutexattr_t attr;
+  int rc = pthread_mutexattr_init(&attr);
+  if (!rc)
+    rc = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  if (!rc)
+    rc = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  if (!rc)
+    rc = pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  return rc;
+}
+
+static int shm_rwlock_init(pthread_rwlock_t* rwlock) {
+  pthread_rwlockattr_t attr;
+  int rc = pthread_rwlockattr_init(&attr);
+  if (!rc)
+    rc = pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  if (!rc)
+    rc = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  if (!rc)
+    rc = pthread_rwlock_init(rwlock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  return rc;
+}
+
+/* lock result of robust mutex: recover after a dead owner and report EOWNERDEAD, the lock is held */
+static int shm_mutex_result(pthread_mutex_t* mutex, int rc) {
+  if (rc == EOWNERDEAD) {
+    pthread_mutex_consistent(mutex);
+    errno = EOWNERDEAD;
+    return EOWNERDEAD;
+  }
+  if (rc)
+    errno = rc;
+  return rc ? 1 : 0;
+}
+
+/* spin shortly in userspace before sleeping in the kernel */
+static int shm_mutex_lock(pthread_mutex_t* mutex) {
+  for (int i = 0; i < SHM_SPIN; ++i) {
+    int const rc = pthread_mutex_trylock(mutex);
+    if (rc != EBUSY)
+      return shm_mutex_result(mutex, rc);
+    shm_relax();
+  }
+  return shm_mutex_result(mutex, pthread_mutex_lock(mutex));
+}
+
+static int shm_open_fd(struct shma_s* shma, int oflag) {
+  char path[512];
+  if (shma->hugetlb) {
+    build_hugetlb_name(shma->name, path, sizeof(path));
+    shma->fd = open(path, oflag, 0666);
+  } else {
+    build_shm_name(shma->name, path, sizeof(path));
+    shma->fd = shm_open(path, oflag, 0666);
+  }
+  if (shma->fd == -1)
+    return errno;
+
+  shma->pagesz = sysconf(_SC_PAGESIZE);
+  if (shma->hugetlb) {
+    /* hugetlbfs reports its huge page size as block size */
+    struct statfs fs;
+    if (fstatfs(shma->fd, &fs))
+      return errno;
+    shma->pagesz = fs.f_bsize;
+  }
+  return 0;
+}
+
+/* whole mapping, rounded up to the page size */
+static size_t shm_map_length(struct shma_s const* shma) {
+  return (SHM_HEADER_SIZE + shma->length + shma->pagesz - 1) / shma->pagesz * shma->pagesz;
+}
+
+static int shm_map(struct shma_s* shma) {
+  shma->maplen = shm_map_length(shma);
+  shma->map = mmap(0, shma->maplen, PROT_WRITE | PROT_READ, MAP_SHARED, shma->fd, 0);
+  if (shma->map == MAP_FAILED) {
+    shma->map = NULL;
+    return errno;
+  }
+  shma->mem = (char*) shma->map + SHM_HEADER_SIZE;
+  return 0;
+}
+
+static void shm_unmap(struct shma_s* shma) {
+  if (shma->map)
+    munmap(shma->map, shma->maplen);
+  if (shma->fd > 0)
+    close(shma->fd);
+  shma->map = shma->mem = NULL;
+  shma->fd = -1;
+}
+
+/* grow backing file to hold SHM_HEADER_SIZE + length, never shrink it under other mappings */
+static int shm_grow(struct shma_s* shma) {
+  struct stat info;
+  if (fstat(shma->fd, &info))
+    return errno;
+  /* hugetlbfs only accepts whole huge pages */
+  size_t const need = shma->hugetlb ? shm_map_length(shma) : SHM_HEADER_SIZE + shma->length;
+  if ((size_t) info.st_size < need && ftruncate(shma->fd, need))
+    return errno;
+  return 0;
+}
+
+/* wait until the creator has published the header, its magic is stored last */
+static int shm_wait_header(struct shma_s* shma) {
+  struct timespec const nap = {0, 1000000};
+  size_t const length = shma->length;
+  int rc = EINVAL;
+
+  /* map the header only, the file may still be empty */
+  shma->length = 0;
+  for (int i = 0; i < SHM_INIT_WAIT; ++i) {
+    struct stat info;
+    if (fstat(shma->fd, &info)) {
+      rc = errno;
+      break;
+    }
+    if (!shma->map && (size_t) info.st_size >= SHM_HEADER_SIZE && (rc = shm_map(shma)))
+      break;
+    if (shma->map && __atomic_load_n(&shm_header(shma)->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC) {
+      rc = 0;
+      break;
+    }
+    rc = EINVAL;
+    nanosleep(&nap, NULL);
+  }
+  shma->length = length;
+  return rc;
+}
+
+/* create backing file of SHM_HEADER_SIZE + length and map it, or map the header of an existing one */
+static int shm_create_map(struct shma_s* shma, int* created) {
+  int rc = 0;
+  *created = 0;
+  do {
+    if ((rc = shm_open_fd(shma, O_CREAT | O_EXCL | O_RDWR)) != EEXIST) {
+      *created = !rc;
+      break;
+    }
+    /* lost the race: open it, or create again when it has been unlinked meanwhile */
+    rc = shm_open_fd(shma, O_RDWR);
+  } while (rc == ENOENT);
+  if (rc)
+    return rc;
+
+  /* only the exclusive creator initialises the header */
+  if (!*created)
+    return shm_wait_header(shma);
+  if ((rc = shm_grow(shma)))
+    return rc;
+  return shm_map(shma);
+}
+
+/* resize the mapping to the current 'length', the address may change */
+static int shm_remap(struct shma_s* shma) {
+  size_t const maplen = shm_map_length(shma);
+  if (maplen == shma->maplen)
+    return 0;
+  void* map = mremap(shma->map, shma->maplen, maplen, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED)
+    return errno;
+  shma->map = map;
+  shma->maplen = maplen;
+  shma->mem = (char*) map + SHM_HEADER_SIZE;
+  return 0;
+}
+
+/* set NUMA policy of the segment on the mapping from offset 'from' on, before its pages are faulted */
+static int shm_numa(struct shma_s* shma, size_t from) {
+  struct shm_header_s const* hdr = shm_header(shma);
+  if (hdr->numa_policy == MSHM_NUMA_DEFAULT || from >= shma->maplen)
+    return 0;
+  char* addr = (char*) shma->map + from;
+  size_t const len = shma->maplen - from;
+  unsigned long nodes = hdr->numa_nodes;
+  /* a tail grown by mremap inherits the policy of its vma, mbind then skips the range of the file */
+  if (from)
+    syscall(SYS_mbind, addr, len, MSHM_NUMA_DEFAULT, NULL, 0, 0);
+  if (syscall(SYS_mbind, addr, len, hdr->numa_policy, &nodes, sizeof(nodes) * 8 + 1, 0))
+    return errno == ENOSYS ? 0 : errno; /* kernel without NUMA: nothing to place */
+  return 0;
+}
+
+/* apply page flags of the segment to this mapping, NUMA policy to the part past 'from' */
+static int shm_setup(struct shma_s* shma, unsigned flags, size_t from) {
+  int const rc = shm_numa(shma, from);
+  if (rc)
+    return rc;
+#ifdef MADV_HUGEPAGE
+  /* advisory only: without THP support the segment keeps small pages */
+  if ((flags & MSHM_HUGEPAGE) && !shma->hugetlb)
+    madvise(shma->map, shma->maplen, MADV_HUGEPAGE);
+#endif
+  /* fault in after madvise/mbind so the pages get the requested size and node */
+  if (flags & (MSHM_POPULATE | MSHM_MLOCK)) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(shma->map, shma->maplen, MADV_POPULATE_WRITE))
+#endif
+    {
+      size_t const step = sysconf(_SC_PAGESIZE);
+      for (size_t off = 0; off < shma->maplen; off += step)
+        __atomic_fetch_add((char*) shma->map + off, 0, __ATOMIC_RELAXED);
+    }
+  }
+  if ((flags & MSHM_MLOCK) && mlock(shma->map, shma->maplen))
+    return errno;
+  return 0;
+}
+
+static int shm_open_sem(struct shma_s* shma, int oflag) {
+  if (shm_header(shma)->flags & MSHM_MUTEX)
+    return 0;
+
+  char sem_name[SHM_SEM_NAME_MAX];
+  build_sem_name(shma->name, sem_name, sizeof(sem_name));
+  shma->sem = oflag ? sem_open(sem_name, oflag, 0666, 1) : sem_open(sem_name, 0);
+  if (shma->sem == SEM_FAILED) {
+    shma->sem = NULL;
+    return errno;
+  }
+  return 0;
+}
+
 mshm_t* mshm_create(char const* name, size_t sz) {
+  return mshm_create_ex(name, sz, NULL);
+}
+
+mshm_t* mshm_create_ex(char const* name, size_t sz, mshm_options_t const* opts) {
   int rc = 0;
   struct shma_s* shma = malloc(sizeof(*shma));
   memset(shma, 0, sizeof(*shma));
   strncpy(shma->name, name, sizeof(shma->name));
   shma->length = sz;
 
-  char shm_name[256];
-  char sem_name[256];
-  build_shm_name(name, shm_name, sizeof(shm_name));
-  build_sem_name(name, sem_name, sizeof(sem_name));
-
-  shma->sem = sem_open(sem_name, O_CREAT, 0666, 1);
-  if (shma->sem == SEM_FAILED) {
-    rc = errno;
-    goto error;
+  unsigned flags = opts ? opts->flags : 0;
+  int created = 0;
+
+  if (flags & MSHM_HUGETLB) {
+    shma->hugetlb = 1;
+    if (shm_create_map(shma, &created)) {
+      /* no hugetlbfs mount or no reserved huge pages: use transparent ones */
+      shm_unmap(shma);
+      if (created) {
+        char path[512];
+        build_hugetlb_name(name, path, sizeof(path));
+        unlink(path);
+      }
+      shma->hugetlb = 0;
+      flags = (flags & ~MSHM_HUGETLB) | MSHM_HUGEPAGE;
+    }
   }
 
-  shma->fd = shm_open(shm_name, O_CREAT | O_RDWR, 0666);
-  if (shma->fd == -1) {
-    rc = errno;
+  if (!shma->map && (rc = shm_create_map(shma, &created)))
     goto error;
+
+  struct shm_header_s* hdr = shm_header(shma);
+  if (created) {
+    hdr->flags = flags;
+    if (opts) {
+      hdr->numa_policy = opts->numa_policy;
+      hdr->numa_nodes = opts->numa_nodes;
+    }
+    if ((flags & MSHM_MUTEX) && (rc = shm_mutex_init(&hdr->mutex)))
+      goto error;
+    if ((rc = shm_rwlock_init(&hdr->rwlock)))
+      goto error;
+    hdr->version = SHM_VERSION;
+    __atomic_store_n(&hdr->length, sz, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  } else {
+    /* keep the header (and lock state) of a live segment */
+    if (hdr->version != SHM_VERSION) {
+      rc = EPROTO;
+      goto error;
+    }
+    /* it may have been grown by mshm_resize: map all of it */
+    size_t const length = __atomic_load_n(&hdr->length, __ATOMIC_ACQUIRE);
+    if (length > sz)
+      shma->length = length;
+    if ((rc = shm_grow(shma)) || (rc = shm_remap(shma)))
+      goto error;
+    hdr = shm_header(shma);
+    if (length < sz) {
+      __atomic_store_n(&hdr->length, sz, __ATOMIC_RELEASE);
+      __atomic_add_fetch(&hdr->generation, 1, __ATOMIC_RELEASE);
+    }
   }
+  shma->generation = __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE);
 
-  if (ftruncate(shma->fd, shma->length)) {
-    rc = errno;
+  if ((rc = shm_setup(shma, hdr->flags, 0)))
     goto error;
-  }
 
-  shma->mem = mmap(0, shma->length, PROT_WRITE | PROT_READ, MAP_SHARED, shma->fd, 0);
-  if (shma->mem == MAP_FAILED) {
-    rc = errno;
-    shma->mem = NULL;
+  if ((rc = shm_open_sem(shma, O_CREAT)))
     goto error;
-  }
 
   return shma;
 
@@ -80,36 +397,51 @@ mshm_t* mshm_open(char const* name) {
   memset(shma, 0, sizeof(*shma));
   strncpy(shma->name, name, sizeof(shma->name));
 
-  char shm_name[256];
-  char sem_name[256];
-  build_shm_name(name, shm_name, sizeof(shm_name));
-  build_sem_name(name, sem_name, sizeof(sem_name));
-
-  shma->sem = sem_open(sem_name, 0);
-  if (shma->sem == SEM_FAILED) {
-    rc = errno;
-    goto error;
+  if ((rc = shm_open_fd(shma, O_RDWR)) == ENOENT) {
+    shma->hugetlb = 1;
+    if (shm_open_fd(shma, O_RDWR))
+      goto error;
+    rc = 0;
   }
-
-  shma->fd = shm_open(shm_name, O_RDWR, 0666);
-  if (shma->fd == -1) {
-    rc = errno;
+  if (rc)
     goto error;
-  }
 
   struct stat info;
   if (fstat(shma->fd, &info)) {
     rc = errno;
     goto error;
   }
-  shma->length = info.st_size;
+  if ((size_t) info.st_size < SHM_HEADER_SIZE) {
+    rc = EINVAL;
+    goto error;
+  }
+  shma->length = info.st_size - SHM_HEADER_SIZE;
 
-  shma->mem = mmap(0, shma->length, PROT_WRITE | PROT_READ, MAP_SHARED, shma->fd, 0);
-  if (shma->mem == MAP_FAILED) {
-    rc = errno;
-    shma->mem = NULL;
+  if ((rc = shm_map(shma)))
+    goto error;
+
+  /* reject foreign, incompatible and truncated segments */
+  struct shm_header_s const* hdr = shm_header(shma);
+  if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+    rc = EINVAL;
     goto error;
   }
+  if (hdr->version != SHM_VERSION) {
+    rc = EPROTO;
+    goto error;
+  }
+  shma->generation = __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE);
+  if (hdr->length > shma->length) {
+    rc = EINVAL;
+    goto error;
+  }
+  shma->length = hdr->length;
+
+  if ((rc = shm_setup(shma, shm_header(shma)->flags, 0)))
+    goto error;
+
+  if ((rc = shm_open_sem(shma, 0)))
+    goto error;
 
   return shma;
 
@@ -120,13 +452,15 @@ error:
 }
 
 void mshm_unlink(char const* name) {
-  char shm_name[256];
-  char sem_name[256];
-  build_shm_name(name, shm_name, sizeof(shm_name));
+  char shm_name[512];
+  char sem_name[SHM_SEM_NAME_MAX];
   build_sem_name(name, sem_name, sizeof(sem_name));
-
   sem_unlink(sem_name);
+
+  build_shm_name(name, shm_name, sizeof(shm_name));
   shm_unlink(shm_name);
+  build_hugetlb_name(name, shm_name, sizeof(shm_name));
+  unlink(shm_name);
 }
 
 void mshm_cleanup(mshm_t* src) {
@@ -135,10 +469,7 @@ void mshm_cleanup(mshm_t* src) {
 
   struct shma_s* shma = (struct shma_s*) src;
 
-  if (shma->mem)
-    munmap(shma->mem, shma->length);
-  if (shma->fd > 0)
-    close(shma->fd);
+  shm_unmap(shma);
   if (shma->sem)
     sem_close(shma->sem);
 
@@ -153,6 +484,9 @@ char const* mshm_name(mshm_t const* src) {
 int mshm_trylock(mshm_t* src) {
   struct shma_s* shma = (struct shma_s*) src;
 
+  if (shma->map && (shm_header(shma)->flags & MSHM_MUTEX))
+    return shm_mutex_result(&shm_header(shma)->mutex, pthread_mutex_trylock(&shm_header(shma)->mutex));
+
   if (!shma->sem) {
     errno = EINVAL;
     return 1;
@@ -167,16 +501,27 @@ int mshm_trylock(mshm_t* src) {
 
 int mshm_lock(mshm_t* src) {
   struct shma_s* shma = (struct shma_s*) src;
+
+  if (shma->map && (shm_header(shma)->flags & MSHM_MUTEX))
+    return shm_mutex_lock(&shm_header(shma)->mutex);
+
   if (!shma->sem) {
     errno = EINVAL;
     return 1;
   }
-  return sem_wait(shma->sem);
+  while (sem_wait(shma->sem)) {
+    if (errno != EINTR)
+      return 1;
+  }
+  return 0;
 }
 
 int mshm_unlock(mshm_t* src) {
   struct shma_s* shma = (struct shma_s*) src;
 
+  if (shma->map && (shm_header(shma)->flags & MSHM_MUTEX))
+    return shm_mutex_result(&shm_header(shma)->mutex, pthread_mutex_unlock(&shm_header(shma)->mutex));
+
   if (!shma->sem) {
     errno = EINVAL;
     return 1;
@@ -192,6 +537,16 @@ int mshm_unlock(mshm_t* src) {
 int mshm_unlock_force(mshm_t* src) {
   struct shma_s* shma = (struct shma_s*) src;
 
+  if (shma->map && (shm_header(shma)->flags & MSHM_MUTEX)) {
+    /* owned by us: plain unlock, dead owner: recovered by trylock */
+    pthread_mutex_t* mutex = &shm_header(shma)->mutex;
+    if (!pthread_mutex_unlock(mutex))
+      return 0;
+    if (shm_mutex_result(mutex, pthread_mutex_trylock(mutex)))
+      return 1;
+    return shm_mutex_result(mutex, pthread_mutex_unlock(mutex));
+  }
+
   if (!shma->sem) {
     errno = EINVAL;
     return 1;
@@ -215,6 +570,122 @@ int mshm_unlock_force(mshm_t* src) {
   return 1;
 }
 
+static int shm_rwlock_result(int rc) {
+  if (rc)
+    errno = rc;
+  return rc ? 1 : 0;
+}
+
+int mshm_rdlock(mshm_t* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  if (!shma->map) {
+    errno = EINVAL;
+    return 1;
+  }
+  return shm_rwlock_result(pthread_rwlock_rdlock(&shm_header(shma)->rwlock));
+}
+
+int mshm_wrlock(mshm_t* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  if (!shma->map) {
+    errno = EINVAL;
+    return 1;
+  }
+  return shm_rwlock_result(pthread_rwlock_wrlock(&shm_header(shma)->rwlock));
+}
+
+int mshm_tryrdlock(mshm_t* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  if (!shma->map) {
+    errno = EINVAL;
+    return 1;
+  }
+  return shm_rwlock_result(pthread_rwlock_tryrdlock(&shm_header(shma)->rwlock));
+}
+
+int mshm_trywrlock(mshm_t* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  if (!shma->map) {
+    errno = EINVAL;
+    return 1;
+  }
+  return shm_rwlock_result(pthread_rwlock_trywrlock(&shm_header(shma)->rwlock));
+}
+
+int mshm_rwunlock(mshm_t* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  if (!shma->map) {
+    errno = EINVAL;
+    return 1;
+  }
+  return shm_rwlock_result(pthread_rwlock_unlock(&shm_header(shma)->rwlock));
+}
+
+int mshm_resize(mshm_t* src, size_t sz) {
+  struct shma_s* shma = (struct shma_s*) src;
+  int rc = 0;
+  if (!shma->map) {
+    errno = EINVAL;
+    return 1;
+  }
+  /* another handle may have grown the segment: never go below the header length */
+  if (mshm_refresh(src))
+    return 1;
+  if (sz < shma->length) {
+    errno = EINVAL;
+    return 1;
+  }
+  if (sz == shma->length)
+    return 0;
+
+  size_t const old = shma->length;
+  size_t const mapped = shma->maplen;
+  shma->length = sz;
+  if ((rc = shm_grow(shma)) || (rc = shm_remap(shma)))
+    goto error;
+
+  struct shm_header_s* hdr = shm_header(shma);
+  __atomic_store_n(&hdr->length, sz, __ATOMIC_RELEASE);
+  shma->generation = __atomic_add_fetch(&hdr->generation, 1, __ATOMIC_RELEASE);
+
+  if ((rc = shm_setup(shma, hdr->flags, mapped))) {
+    errno = rc;
+    return 1;
+  }
+  return 0;
+
+error:
+  shma->length = old;
+  errno = rc;
+  return 1;
+}
+
+int mshm_refresh(mshm_t* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  if (!shma->map) {
+    errno = EINVAL;
+    return 1;
+  }
+  struct shm_header_s* hdr = shm_header(shma);
+  uint64_t const generation = __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE);
+  if (generation == shma->generation)
+    return 0;
+
+  size_t const old = shma->length;
+  size_t const mapped = shma->maplen;
+  shma->length = hdr->length;
+  int const rc = shm_remap(shma);
+  if (rc) {
+    shma->length = old;
+    errno = rc;
+    return 1;
+  }
+  shma->generation = generation;
+  if (shm_setup(shma, shm_header(shma)->flags, mapped))
+    return 1;
+  return 0;
+}
+
 void* mshm_memory_ptr(mshm_t const* src) {
   struct shma_s* shma = (struct shma_s*) src;
   if (!shma->mem)
@@ -224,8 +695,39 @@ void* mshm_memory_ptr(mshm_t const* src) {
 
 size_t mshm_memory_size(mshm_t const* src) {
   struct shma_s* shma = (struct shma_s*) src;
-  struct stat info;
-  if (fstat(shma->fd, &info) == 0)
-    return info.st_size;
-  return 0;
+  if (!shma->map)
+    return 0;
+  return __atomic_load_n(&shm_header(shma)->length, __ATOMIC_ACQUIRE);
+}
+
+size_t mshm_mapped_size(mshm_t const* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  return shma->map ? shma->length : 0;
+}
+
+uint64_t mshm_generation(mshm_t const* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  if (!shma->map)
+    return 0;
+  return __atomic_load_n(&shm_header(shma)->generation, __ATOMIC_ACQUIRE);
+}
+
+uint32_t mshm_event(mshm_t const* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  return mevent_seq(&shm_header(shma)->event);
+}
+
+int mshm_wait(mshm_t* src, uint32_t seq, int timeout_ms) {
+  struct shma_s* shma = (struct shma_s*) src;
+  return mevent_wait(&shm_header(shma)->event, seq, timeout_ms);
+}
+
+void mshm_notify_one(mshm_t* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  mevent_notify_one(&shm_header(shma)->event);
+}
+
+void mshm_notify_all(mshm_t* src) {
+  struct shma_s* shma = (struct shma_s*) src;
+  mevent_notify_all(&shm_header(shma)->event);
 }
@@ -0,0 +1,133 @@
+#include <mitosha.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Fixed-size object slab: pages are taken from the pool, objects carry no
+ * header. Free objects are chained through their first word, objects never
+ * used yet are handed out from the newest page by bumping.
+ */
+#define MSLAB_PAGE_HINT 4096
+
+typedef struct {
+  mvoid_t next;
+} slab_page_t;
+
+typedef struct {
+  mvoid_t next;
+} slab_free_t;
+
+struct mslab_s {
+  size_t marker;
+  size_t objsize;
+  size_t perpage;
+  size_t count; /* allocated objects */
+  mvoid_t pool;
+  mvoid_t pages;
+  mvoid_t free;
+  mvoid_t bump; /* first untouched object of the newest page */
+  size_t bump_left;
+};
+
+static const size_t MSLAB_MARKER = 0x4d534c4142fafafa; // MSLAB
+
+static inline size_t slab_align(size_t size) {
+  if (size < sizeof(slab_free_t))
+    size = sizeof(slab_free_t);
+  return (size + sizeof(mvoid_t) - 1) & ~(sizeof(mvoid_t) - 1);
+}
+
+static int slab_grow(mslab_t* slab) {
+  mpool_t* pool = mvoid_get(&slab->pool);
+  slab_page_t* page = mpool_alloc(pool, sizeof(*page) + slab->perpage * slab->objsize);
+  if (!page)
+    return 1;
+  mvoid_set(&page->next, mvoid_get(&slab->pages));
+  mvoid_set(&slab->pages, page);
+  mvoid_set(&slab->bump, page + 1);
+  slab->bump_left = slab->perpage;
+  return 0;
+}
+
+mslab_t* mslab_format(mpool_t* pool, size_t objsize, size_t perpage) {
+  if (!pool || !objsize) {
+    fprintf(stderr, "%s invalid arguments\n", __func__);
+    return NULL;
+  }
+
+  mslab_t* slab = mpool_alloc(pool, sizeof(*slab));
+  if (!slab)
+    return NULL;
+
+  memset(slab, 0, sizeof(*slab));
+  slab->marker = MSLAB_MARKER;
+  slab->objsize = slab_align(objsize);
+  slab->perpage = perpage;
+  if (!slab->perpage)
+    slab->perpage = (MSLAB_PAGE_HINT - sizeof(slab_page_t)) / slab->objsize;
+  if (!slab->perpage)
+    slab->perpage = 1;
+  mvoid_set(&slab->pool, pool);
+  return slab;
+}
+
+mslab_t* mslab_attach_existing(void* src) {
+  if (!src)
+    return NULL;
+  mslab_t* slab = (mslab_t*) src;
+  if (slab->marker == MSLAB_MARKER)
+    return slab;
+  fprintf(stderr, "%s invalid MSLAB marker\n", __func__);
+  return NULL;
+}
+
+void mslab_cleanup(mslab_t* slab) {
+  if (!slab)
+    return;
+  mpool_t* pool = mvoid_get(&slab->pool);
+  slab_page_t* page = mvoid_get(&slab->pages);
+  while (page) {
+    slab_page_t* next = mvoid_get(&page->next);
+    mpool_free(pool, page);
+    page = next;
+  }
+  slab->marker = 0;
+  mpool_free(pool, slab);
+}
+
+void* mslab_alloc(mslab_t* slab) {
+  slab_free_t* obj = mvoid_get(&slab->free);
+  if (obj) {
+    mvoid_set(&slab->free, mvoid_get(&obj->next));
+    ++slab->count;
+    return obj;
+  }
+
+  if (!slab->bump_left && slab_grow(slab))
+    return NULL;
+
+  char* mem = mvoid_get(&slab->bump);
+  if (--slab->bump_left)
+    mvoid_set(&slab->bump, mem + slab->objsize);
+  else
+    mvoid_set(&slab->bump, NULL);
+  ++slab->count;
+  return mem;
+}
+
+void mslab_free(mslab_t* slab, void* ptr) {
+  if (!ptr)
+    return;
+  slab_free_t* obj = ptr;
+  mvoid_set(&obj->next, mvoid_get(&slab->free));
+  mvoid_set(&slab->free, obj);
+  --slab->count;
+}
+
+size_t mslab_object_size(mslab_t const* slab) {
+  return slab->objsize;
+}
+
+size_t mslab_count(mslab_t const* slab) {
+  return slab->count;
+}
@@ -0,0 +1,88 @@
+#include <mutest.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mitosha.h>
+
+typedef struct {
+  avlnode_t node;
+  int age;
+} person_t;
+
+static int person_cmp(avlnode_t const* l, avlnode_t const* r) {
+  return mcontainer_of(l, person_t, node)->age - mcontainer_of(r, person_t, node)->age;
+}
+
+void mu_test_arena_alloc() {
+  char b[1024];
+  mu_check(!marena_format(b, 8));
+
+  marena_t* a = marena_format(b, sizeof(b));
+  mu_ensure(a);
+  mu_check(marena_attach_existing(b) == a);
+  mu_check(0 == marena_used(a));
+  size_t const room = marena_free_space(a);
+
+  char* p1 = marena_alloc(a, 3);
+  char* p2 = marena_alloc(a, 5);
+  mu_ensure(p1 && p2);
+  mu_check(p2 - p1 == sizeof(mvoid_t));
+  mu_check(0 == (uintptr_t) p2 % sizeof(mvoid_t));
+
+  char* p3 = marena_alloc_aligned(a, 1, 64);
+  mu_ensure(p3);
+  mu_check(0 == (uintptr_t) p3 % 64);
+  mu_check(!marena_alloc_aligned(a, 1, 3));
+
+  size_t const mark = marena_checkpoint(a);
+  mu_check(marena_alloc(a, 100));
+  marena_rollback(a, mark);
+  mu_check(marena_checkpoint(a) == mark);
+  mu_check(marena_alloc(a, 1) == p3 + sizeof(mvoid_t));
+
+  mu_check(!marena_alloc(a, room));
+  marena_reset(a);
+  mu_check(marena_alloc(a, room));
+  mu_check(0 == marena_free_space(a));
+  mu_check(!marena_alloc(a, 1));
+}
+
+void mu_test_arena_tree() {
+  size_t const sz = 1024 * 1024;
+  char* b = malloc(sz);
+  mu_ensure(b);
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  /* arena inside a pool block, tree built with no per-node pool header */
+  size_t const count = 1000;
+  size_t const asz = 64 + sizeof(avltree_t) + count * sizeof(person_t);
+  marena_t* a = marena_format(mpool_alloc(p, asz), asz);
+  mu_ensure(a);
+
+  avltree_t* tree = marena_alloc(a, sizeof(avltree_t));
+  mu_ensure(tree);
+  avltree_init(tree);
+  size_t const mark = marena_checkpoint(a);
+
+  for (int round = 0; round < 2; ++round) {
+    for (size_t i = 0; i < count; ++i) {
+      person_t* person = marena_zalloc(a, sizeof(person_t));
+      mu_ensure(person);
+      person->age = (int) ((i * 7919) % count);
+      mu_check(!avltree_insert(&person->node, person_cmp, tree));
+    }
+    int expect = 0;
+    for (avlnode_t* n = avltree_first(tree); n; n = avltree_next(n))
+      mu_check(mcontainer_of(n, person_t, node)->age == expect++);
+    mu_check(expect == (int) count);
+
+    /* discard the whole tree at once */
+    marena_rollback(a, mark);
+    avltree_init(tree);
+  }
+
+  mpool_free(p, a);
+  mu_check(0 == mpool_used(p));
+  free(b);
+}
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <mitosha.h>
 
 /*-------------------------------------------------------------------------*/
@@ -432,3 +433,217 @@ void mu_test_avltree_example() {
 
   clear();
 }
+
+static int quiet_cmp(avlnode_t const* a, avlnode_t const* b) {
+  return ((value_t*) a)->v - ((value_t*) b)->v;
+}
+
+void mu_test_avltree_seqlock() {
+  value_t vals[32];
+  avltree_t tree;
+  avltree_init(&tree);
+
+  avltree_write_begin(&tree);
+  for (int i = 0; i < 32; ++i) {
+    vals[i].v = i * 2;
+    avltree_insert(&vals[i].node, quiet_cmp, &tree);
+  }
+  avltree_write_end(&tree);
+
+  void const* lo = vals;
+  void const* hi = vals + 32;
+  value_t key = {{}, 10};
+
+  unsigned seq = avltree_read_begin(&tree);
+  mu_check(!(seq & 1));
+  avlnode_t* node = avltree_lookup_seq(&key.node, quiet_cmp, &tree, lo, hi);
+  mu_ensure(node);
+  mu_check(((value_t*) node)->v == 10);
+  key.v = 11;
+  node = avltree_lower_seq(&key.node, quiet_cmp, &tree, lo, hi);
+  mu_ensure(node);
+  mu_check(((value_t*) node)->v == 12);
+  key.v = 64;
+  mu_check(!avltree_lower_seq(&key.node, quiet_cmp, &tree, lo, hi));
+  mu_check(!avltree_read_retry(&tree, seq));
+
+  /* any write invalidates a read in progress */
+  avltree_write_begin(&tree);
+  avltree_remove(&vals[5].node, &tree);
+  avltree_write_end(&tree);
+  mu_check(avltree_read_retry(&tree, seq));
+
+  /* nodes outside [lo, hi) are never followed */
+  key.v = 20;
+  mu_check(!avltree_lookup_seq(&key.node, quiet_cmp, &tree, vals + 32, vals + 32));
+}
+
+typedef struct {
+  avltree_t tree;
+  value_t vals[64];
+  int stop;
+} seq_shared_t;
+
+static void* seq_writer(void* arg) {
+  seq_shared_t* sh = arg;
+  for (int round = 0; round < 2000; ++round) {
+    int const i = round % 64;
+    /* one write section: readers never see the key missing */
+    avltree_write_begin(&sh->tree);
+    avltree_remove(&sh->vals[i].node, &sh->tree);
+    avltree_insert(&sh->vals[i].node, quiet_cmp, &sh->tree);
+    avltree_write_end(&sh->tree);
+  }
+  __atomic_store_n(&sh->stop, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+void mu_test_avltree_seqlock_threads() {
+  seq_shared_t* sh = calloc(1, sizeof(*sh));
+  avltree_init(&sh->tree);
+  for (int i = 0; i < 64; ++i) {
+    sh->vals[i].v = i;
+    avltree_insert(&sh->vals[i].node, quiet_cmp, &sh->tree);
+  }
+
+  pthread_t th;
+  mu_ensure(0 == pthread_create(&th, NULL, seq_writer, sh));
+
+  int bad = 0;
+  while (!__atomic_load_n(&sh->stop, __ATOMIC_ACQUIRE)) {
+    for (int k = 0; k < 64; ++k) {
+      value_t key = {{}, k};
+      avlnode_t* node;
+      unsigned seq;
+      do {
+        seq = avltree_read_begin(&sh->tree);
+        node = avltree_lookup_seq(&key.node, quiet_cmp, &sh->tree, sh->vals, sh->vals + 64);
+      } while (avltree_read_retry(&sh->tree, seq));
+      if (!node || ((value_t*) node)->v != k)
+        ++bad;
+    }
+  }
+  pthread_join(th, NULL);
+  mu_check(bad == 0);
+  free(sh);
+}
+
+/* verify links, balance factors and return height */
+static int check_avl(avlnode_t* node, avlnode_t* parent) {
+  if (!node)
+    return -1;
+  mu_check(mvoid_get(&node->parent) == parent);
+  int const lh = check_avl(mvoid_get(&node->left), node);
+  int const rh = check_avl(mvoid_get(&node->right), node);
+  mu_check(node->balance == rh - lh);
+  mu_check(rh - lh >= -1 && rh - lh <= 1);
+  return (lh > rh ? lh : rh) + 1;
+}
+
+void mu_test_avltree_build_sorted() {
+  value_t vals[100];
+  avlnode_t* nodes[100];
+  for (int i = 0; i < 100; ++i) {
+    vals[i].v = i * 3;
+    nodes[i] = &vals[i].node;
+  }
+
+  for (size_t n = 0; n <= 100; ++n) {
+    avltree_t tree;
+    avltree_init(&tree);
+    avltree_build_sorted(nodes, n, &tree);
+    mu_check(tree.height == check_avl(mvoid_get(&tree.root), NULL));
+    mu_check(avltree_first(&tree) == (n ? nodes[0] : NULL));
+    mu_check(avltree_last(&tree) == (n ? nodes[n - 1] : NULL));
+
+    int i = 0;
+    for (avlnode_t* node = avltree_first(&tree); node; node = avltree_next(node))
+      mu_check(node == nodes[i++]);
+    mu_check(i == (int) n);
+
+    for (size_t k = 0; k < n; ++k)
+      mu_check(avltree_lookup(nodes[k], quiet_cmp, &tree) == nodes[k]);
+  }
+
+  /* a built tree keeps working with insert/remove */
+  avltree_t tree;
+  avltree_init(&tree);
+  avltree_build_sorted(nodes, 99, &tree);
+  vals[99].v = 1;
+  mu_check(!avltree_insert(nodes[99], quiet_cmp, &tree));
+  avltree_remove(nodes[50], &tree);
+  mu_check(tree.height == check_avl(mvoid_get(&tree.root), NULL));
+  mu_check(avltree_next(nodes[0]) == nodes[99]);
+}
+
+typedef struct {
+  listnode_t list;
+  int v;
+  avlnode_t avl;
+} lvalue_t;
+
+static int lvalue_cmp(avlnode_t const* a, avlnode_t const* b) {
+  return mcontainer_of(a, lvalue_t, avl)->v - mcontainer_of(b, lvalue_t, avl)->v;
+}
+
+void mu_test_avltree_build_sorted_list() {
+  lvalue_t vals[37];
+  list_t list;
+  list_init(&list);
+  for (int i = 0; i < 37; ++i) {
+    vals[i].v = i;
+    list_push_back(&vals[i].list, &list);
+  }
+
+  avltree_t tree;
+  avltree_init(&tree);
+  avltree_build_sorted_list(&list, offsetof(lvalue_t, avl) - offsetof(lvalue_t, list), &tree);
+  mu_check(tree.height == check_avl(mvoid_get(&tree.root), NULL));
+  mu_check(avltree_first(&tree) == &vals[0].avl);
+  mu_check(avltree_last(&tree) == &vals[36].avl);
+
+  int i = 0;
+  for (avlnode_t* node = avltree_first(&tree); node; node = avltree_next(node))
+    mu_check(mcontainer_of(node, lvalue_t, avl)->v == i++);
+  mu_check(i == 37);
+  mu_check(avltree_lookup(&vals[20].avl, lvalue_cmp, &tree) == &vals[20].avl);
+  mu_check(list_front(&list) == &vals[0].list && list_back(&list) == &vals[36].list);
+}
+
+#define value_keycmp(a, b) ((a)->v - (b)->v)
+AVLTREE_DEFINE(value_tree, value_t, node, value_keycmp)
+
+void mu_test_avltree_define() {
+  value_t vals[64];
+  avltree_t tree;
+  avltree_init(&tree);
+  for (int i = 0; i < 64; ++i) {
+    vals[i].v = (i * 37) % 64 * 2;
+    mu_check(!value_tree_insert(&tree, &vals[i]));
+  }
+  value_t dup = {{}, 10};
+  mu_check(value_tree_insert(&tree, &dup) != NULL);
+  mu_check(tree.height == check_avl(mvoid_get(&tree.root), NULL));
+
+  int expect = 0;
+  for (avlnode_t* node = avltree_first(&tree); node; node = avltree_next(node), expect += 2)
+    mu_check(value_tree_entry(node)->v == expect);
+  mu_check(expect == 128);
+
+  value_t key = {{}, 20};
+  value_t* r = value_tree_lookup(&tree, &key);
+  mu_ensure(r);
+  mu_check(r->v == 20 && &r->node == avltree_lookup(&key.node, quiet_cmp, &tree));
+  mu_check(value_tree_upper(&tree, &key)->v == 22);
+  key.v = 21;
+  mu_check(!value_tree_lookup(&tree, &key));
+  mu_check(value_tree_lower(&tree, &key)->v == 22);
+  key.v = 126;
+  mu_check(!value_tree_upper(&tree, &key));
+
+  /* generic removal on a tree built by the generated insert */
+  avltree_remove(&r->node, &tree);
+  key.v = 20;
+  mu_check(!value_tree_lookup(&tree, &key));
+  mu_check(tree.height == check_avl(mvoid_get(&tree.root), NULL));
+}
@@ -0,0 +1,135 @@
+#include <mutest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mitosha.h>
+
+static int u64_cmp(void const* a, void const* b) {
+  uint64_t const x = *(uint64_t const*) a;
+  uint64_t const y = *(uint64_t const*) b;
+  return x < y ? -1 : x > y;
+}
+
+void mu_test_btree_basic() {
+  size_t const sz = 1024 * 1024;
+  char* b = malloc(sz);
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  btree_t tree;
+  btree_init(&tree, p);
+  btree_iter_t it;
+  mu_check(!btree_lookup(&tree, 1));
+  mu_check(!btree_first(&tree, &it));
+  mu_check(!btree_lower(&tree, 1, &it));
+  mu_check(1 == btree_remove(&tree, 1));
+
+  for (uint64_t k = 0; k < 1000; ++k)
+    mu_check(0 == btree_insert(&tree, k * 2, k));
+  mu_check(1 == btree_insert(&tree, 10, 77));
+  mu_check(1000 == btree_count(&tree));
+  mu_check(tree.height >= 1 && tree.height <= 3);
+
+  uint64_t* v = btree_lookup(&tree, 10);
+  mu_ensure(v);
+  mu_check(*v == 5);
+  mu_check(!btree_lookup(&tree, 11));
+
+  mu_check(btree_lower(&tree, 11, &it));
+  mu_check(btree_iter_key(&it) == 12);
+  mu_check(btree_lower(&tree, 12, &it));
+  mu_check(btree_iter_key(&it) == 12);
+  mu_check(btree_upper(&tree, 12, &it));
+  mu_check(btree_iter_key(&it) == 14);
+  mu_check(!btree_upper(&tree, 1998, &it));
+  mu_check(btree_prev(&it) == 0);
+
+  uint64_t expect = 0;
+  for (int ok = btree_first(&tree, &it); ok; ok = btree_next(&it)) {
+    mu_check(btree_iter_key(&it) == expect);
+    mu_check(*btree_iter_value(&it) == expect / 2);
+    expect += 2;
+  }
+  mu_check(expect == 2000);
+
+  for (int ok = btree_last(&tree, &it); ok; ok = btree_prev(&it))
+    expect -= 2;
+  mu_check(expect == 0);
+
+  btree_cleanup(&tree);
+  mu_check(0 == btree_count(&tree));
+  mu_check(0 == mpool_used(p));
+  free(b);
+}
+
+void mu_test_btree_random() {
+  size_t const count = 50000;
+  size_t const sz = mpool_calc_required_size(512, count / 10);
+  char* b = malloc(sz);
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  uint64_t* keys = malloc(count * sizeof(uint64_t));
+  srand(7);
+  btree_t tree;
+  btree_init(&tree, p);
+  size_t n = 0;
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t const k = ((uint64_t) rand() << 20) ^ rand();
+    int const rc = btree_insert(&tree, k, ~k);
+    mu_ensure(rc >= 0);
+    if (!rc)
+      keys[n++] = k;
+  }
+  mu_check(btree_count(&tree) == n);
+  qsort(keys, n, sizeof(uint64_t), u64_cmp);
+
+  btree_iter_t it;
+  size_t i = 0;
+  for (int ok = btree_first(&tree, &it); ok; ok = btree_next(&it), ++i)
+    mu_check(btree_iter_key(&it) == keys[i] && *btree_iter_value(&it) == ~keys[i]);
+  mu_check(i == n);
+
+  /* remove every other key, then everything */
+  for (i = 0; i < n; i += 2)
+    mu_check(0 == btree_remove(&tree, keys[i]));
+  mu_check(btree_count(&tree) == n / 2);
+  for (i = 0; i < n; ++i)
+    mu_check((btree_lookup(&tree, keys[i]) != NULL) == (i % 2 == 1));
+  i = 1;
+  for (int ok = btree_first(&tree, &it); ok; ok = btree_next(&it), i += 2)
+    mu_check(btree_iter_key(&it) == keys[i]);
+
+  for (i = 1; i < n; i += 2)
+    mu_check(0 == btree_remove(&tree, keys[i]));
+  mu_check(0 == btree_count(&tree));
+  mu_check(-1 == tree.height);
+  mu_check(0 == mpool_used(p));
+
+  free(keys);
+  free(b);
+}
+
+void mu_test_btree_pool_full() {
+  size_t const sz = mpool_calc_required_size(512, 4);
+  char b[sz];
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  btree_t tree;
+  btree_init(&tree, p);
+  uint64_t k = 0;
+  int rc;
+  while (!(rc = btree_insert(&tree, k, k)))
+    ++k;
+  mu_check(-1 == rc);
+  mu_check(btree_count(&tree) == k);
+
+  /* a failed insert leaves the tree intact */
+  btree_iter_t it;
+  uint64_t expect = 0;
+  for (int ok = btree_first(&tree, &it); ok; ok = btree_next(&it))
+    mu_check(btree_iter_key(&it) == expect++);
+  mu_check(expect == k);
+  btree_cleanup(&tree);
+  mu_check(0 == mpool_used(p));
+}
@@ -0,0 +1,76 @@
+#include <mutest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mitosha.h>
+
+void mu_test_cache_alloc() {
+  size_t const sz = mpool_calc_required_size(64, 1000);
+  char* b = malloc(sz);
+  mu_ensure(b);
+
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  mcache_t* c = mcache_create(p, NULL);
+  mu_ensure(c);
+
+  void* v[500];
+  for (size_t i = 0; i < 500; ++i) {
+    v[i] = mcache_alloc(c, 1 + i % 64);
+    mu_ensure(v[i]);
+    mu_check(mpool_block_size(v[i]) >= 1 + i % 64);
+    memset(v[i], (int) i, 1 + i % 64);
+  }
+
+  for (size_t i = 0; i < 500; ++i)
+    mcache_free(c, v[i]);
+  mu_check(mpool_used(p) > 0);
+
+  /* served from magazine, pool is not touched */
+  size_t const used = mpool_used(p);
+  void* r = mcache_alloc(c, 64);
+  mu_check(r);
+  mu_check(mpool_block_size(r) >= 64);
+  mu_check(used == mpool_used(p));
+  mcache_free(c, r);
+  mu_check(used == mpool_used(p));
+
+  mu_check(0 == mcache_flush(c));
+  mu_check(0 == mpool_used(p));
+
+  void* big = mcache_alloc(c, 4096);
+  mu_check(big);
+  mcache_free(c, big);
+  mu_check(0 == mpool_used(p));
+
+  mcache_cleanup(c);
+  free(b);
+}
+
+void mu_test_cache_shm() {
+  mshm_t* shm = mshm_create("mitosha_cache", mpool_calc_required_size(32, 200));
+  mu_ensure(shm);
+
+  mpool_t* p = mpool_format_memory(mshm_memory_ptr(shm), mshm_memory_size(shm));
+  mu_ensure(p);
+
+  mcache_t* c = mcache_create(p, shm);
+  mu_ensure(c);
+
+  void* v[200];
+  size_t n = 0;
+  while (n < 200 && (v[n] = mcache_alloc(c, 32)))
+    ++n;
+  mu_check(n > 100);
+
+  for (size_t i = 0; i < n; ++i)
+    mcache_free(c, v[i]);
+
+  mcache_cleanup(c);
+  mu_check(0 == mpool_used(p));
+  mu_check(0 == mshm_trylock(shm));
+  mu_check(0 == mshm_unlock(shm));
+
+  mshm_cleanup(shm);
+  mshm_unlink("mitosha_cache");
+}
@@ -0,0 +1,118 @@
+#include <mutest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <mitosha.h>
+
+void mu_test_chan_basic() {
+  size_t const sz = 4096;
+  char* b = malloc(sz);
+  mu_check(!mchan_format(b, 16));
+
+  mchan_t* c = mchan_format(b, sz);
+  mu_ensure(c);
+  mu_check(c == mchan_attach_existing(b));
+  size_t const cap = mchan_capacity(c);
+  mu_check(cap >= 1024 && cap <= sz);
+  mu_check(!mchan_reserve(c, cap));
+
+  size_t len = 1;
+  mu_check(!mchan_peek(c, &len));
+
+  char* m = mchan_reserve(c, 100);
+  mu_ensure(m);
+  mu_check(!((uintptr_t) m % 8));
+  strcpy(m, "hello");
+  mu_check(!mchan_peek(c, &len)); /* not committed yet */
+  mchan_commit(c, 6);
+
+  char* r = mchan_peek(c, &len);
+  mu_ensure(r);
+  mu_check(r == m);
+  mu_check(len == 6 && !strcmp(r, "hello"));
+  mu_check(r == mchan_peek(c, NULL));
+  mchan_release(c);
+  mu_check(!mchan_peek(c, &len));
+  free(b);
+}
+
+void mu_test_chan_wrap() {
+  size_t const sz = 2048;
+  char* b = malloc(sz);
+  mchan_t* c = mchan_format(b, sz);
+  mu_ensure(c);
+  size_t const cap = mchan_capacity(c);
+
+  /* odd sizes make messages end anywhere, queue depth varies */
+  unsigned wr = 0, rd = 0;
+  srand(5);
+  for (int it = 0; it < 100000; ++it) {
+    if (rand() % 2) {
+      size_t const n = 1 + (size_t) (wr * 7919u) % (cap / 2 - 8);
+      char* m = mchan_reserve(c, n);
+      if (!m)
+        continue;
+      memset(m, (char) wr, n);
+      mchan_commit(c, n);
+      ++wr;
+    } else {
+      size_t n = 0;
+      unsigned char* m = mchan_peek(c, &n);
+      if (!m) {
+        mu_check(rd == wr);
+        continue;
+      }
+      mu_check(n == 1 + (size_t) (rd * 7919u) % (cap / 2 - 8));
+      mu_check(m[0] == (unsigned char) rd && m[n - 1] == (unsigned char) rd);
+      mchan_release(c);
+      ++rd;
+    }
+  }
+  mu_check(wr > 1000 && rd > 1000);
+  free(b);
+}
+
+void mu_test_chan_fork() {
+  mshm_unlink("mitosha_chan");
+  mshm_t* m = mshm_create("mitosha_chan", 64 * 1024);
+  mu_ensure(m);
+  mchan_t* c = mchan_format(mshm_memory_ptr(m), mshm_memory_size(m));
+  mu_ensure(c);
+
+  int const count = 100000;
+  pid_t pid = fork();
+  mu_ensure(pid >= 0);
+  if (!pid) {
+    mshm_t* s = mshm_open("mitosha_chan");
+    mchan_t* p = s ? mchan_attach_existing(mshm_memory_ptr(s)) : NULL;
+    if (!p)
+      _exit(1);
+    for (int i = 0; i < count; ++i) {
+      int* msg;
+      while (!(msg = mchan_reserve(p, (1 + i % 50) * sizeof(int))))
+        ;
+      for (int k = 0; k <= i % 50; ++k)
+        msg[k] = i;
+      mchan_commit(p, (1 + i % 50) * sizeof(int));
+    }
+    _exit(0);
+  }
+
+  int bad = 0;
+  for (int i = 0; i < count; ++i) {
+    size_t n;
+    int* msg;
+    while (!(msg = mchan_peek(c, &n)))
+      ;
+    bad += n != (1 + i % 50) * sizeof(int) || msg[0] != i || msg[n / sizeof(int) - 1] != i;
+    mchan_release(c);
+  }
+  mu_check(!bad);
+
+  int status = 0;
+  mu_ensure(pid == waitpid(pid, &status, 0));
+  mu_check(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+  mshm_cleanup(m);
+  mshm_unlink("mitosha_chan");
+}
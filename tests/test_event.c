@@ -0,0 +1,50 @@
+#include <mutest.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <mitosha.h>
+
+void mu_test_event_timeout() {
+  mevent_t ev = {0};
+  uint32_t const seq = mevent_seq(&ev);
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  mu_check(ETIMEDOUT == mevent_wait(&ev, seq, 20));
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  mu_check((t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000 >= 19);
+
+  /* notified after seq was taken: no sleep */
+  mevent_notify_one(&ev);
+  mu_check(seq + 1 == mevent_seq(&ev));
+  mu_check(0 == mevent_wait(&ev, seq, -1));
+  mu_check(ev.state == (uint64_t) (seq + 1) << 32);
+}
+
+static mevent_t event_shared;
+static int event_flag;
+
+static void* event_waiter(void* arg) {
+  (void) arg;
+  for (;;) {
+    uint32_t const seq = mevent_seq(&event_shared);
+    if (__atomic_load_n(&event_flag, __ATOMIC_ACQUIRE))
+      return NULL;
+    mevent_wait(&event_shared, seq, -1);
+  }
+}
+
+void mu_test_event_threads() {
+  pthread_t th[4];
+  for (int round = 0; round < 100; ++round) {
+    event_flag = 0;
+    for (int i = 0; i < 4; ++i)
+      pthread_create(&th[i], NULL, event_waiter, NULL);
+    __atomic_store_n(&event_flag, 1, __ATOMIC_RELEASE);
+    mevent_notify_all(&event_shared);
+    for (int i = 0; i < 4; ++i)
+      pthread_join(th[i], NULL);
+  }
+  /* waiters unregister on the way out */
+  mu_check(0 == (event_shared.state & 0xffffffff));
+}
@@ -0,0 +1,134 @@
+#include <mutest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mitosha.h>
+
+typedef struct {
+  hashnode_t node;
+  uint64_t id;
+  int value;
+} session_t;
+
+static uint64_t session_hash(uint64_t id) {
+  id ^= id >> 33;
+  id *= 0xff51afd7ed558ccdULL;
+  id ^= id >> 33;
+  return id;
+}
+
+static int session_eq(hashnode_t const* a, hashnode_t const* b) {
+  return mcontainer_of(a, session_t, node)->id == mcontainer_of(b, session_t, node)->id;
+}
+
+static session_t* session_find(hashtable_t const* table, uint64_t id) {
+  session_t key = {{0}, id, 0};
+  hashnode_t* node = hashtable_lookup(table, &key.node, session_hash(id), session_eq);
+  return node ? mcontainer_of(node, session_t, node) : NULL;
+}
+
+void mu_test_hash_basic() {
+  size_t const sz = 1024 * 1024;
+  char* b = malloc(sz);
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  hashtable_t table;
+  mu_ensure(0 == hashtable_init(&table, p, 4));
+
+  session_t s[1000];
+  for (size_t i = 0; i < 1000; ++i) {
+    s[i].id = i * 7;
+    s[i].value = (int) i;
+    mu_check(0 == hashtable_insert(&table, &s[i].node, session_hash(s[i].id), session_eq));
+  }
+  mu_check(1000 == hashtable_count(&table));
+
+  session_t dup = {{0}, 14, -1};
+  mu_check(1 == hashtable_insert(&table, &dup.node, session_hash(14), session_eq));
+
+  for (size_t i = 0; i < 1000; ++i) {
+    session_t* f = session_find(&table, i * 7);
+    mu_check(f == &s[i]);
+  }
+  mu_check(!session_find(&table, 1));
+
+  /* iteration sees every node once, also while growing */
+  size_t pos = 0, n = 0;
+  long sum = 0;
+  for (hashnode_t* node; (node = hashtable_next(&table, &pos)); ++n)
+    sum += mcontainer_of(node, session_t, node)->value;
+  mu_check(n == 1000);
+  mu_check(sum == 999 * 1000 / 2);
+
+  session_t key = {{0}, 21, 0};
+  mu_check(hashtable_remove(&table, &key.node, session_hash(21), session_eq) == &s[3].node);
+  mu_check(!hashtable_remove(&table, &key.node, session_hash(21), session_eq));
+  mu_check(!session_find(&table, 21));
+  mu_check(999 == hashtable_count(&table));
+
+  hashtable_cleanup(&table);
+  mu_check(0 == mpool_used(p));
+  free(b);
+}
+
+void mu_test_hash_random() {
+  size_t const count = 20000;
+  size_t const sz = 8 * 1024 * 1024;
+  char* b = malloc(sz);
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  session_t* s = calloc(count, sizeof(session_t));
+  char* in = calloc(count, 1);
+  hashtable_t table;
+  mu_ensure(0 == hashtable_init(&table, p, 0));
+
+  srand(11);
+  size_t n = 0;
+  for (int it = 0; it < 200000; ++it) {
+    size_t const i = rand() % count;
+    s[i].id = i;
+    if (rand() % 3) {
+      int const rc = hashtable_insert(&table, &s[i].node, session_hash(i), session_eq);
+      mu_check(rc == (in[i] ? 1 : 0));
+      if (!rc)
+        in[i] = 1, ++n;
+    } else {
+      hashnode_t* node = hashtable_remove(&table, &s[i].node, session_hash(i), session_eq);
+      mu_check(node == (in[i] ? &s[i].node : NULL));
+      if (node)
+        in[i] = 0, --n;
+    }
+  }
+  mu_check(hashtable_count(&table) == n);
+  for (size_t i = 0; i < count; ++i)
+    mu_check((session_find(&table, i) != NULL) == in[i]);
+
+  hashtable_cleanup(&table);
+  mu_check(0 == mpool_used(p));
+  free(in);
+  free(s);
+  free(b);
+}
+
+void mu_test_hash_pool_full() {
+  size_t const sz = mpool_calc_required_size(16 * 64, 1);
+  char* b = malloc(sz);
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  hashtable_t table;
+  mu_ensure(0 == hashtable_init(&table, p, 40));
+  session_t s[64];
+  size_t i = 0;
+  int rc = 0;
+  for (; i < 64 && !(rc = hashtable_insert(&table, &s[i].node, session_hash(s[i].id = i), session_eq)); ++i)
+    ;
+  mu_check(-1 == rc);
+  mu_check(hashtable_count(&table) == i);
+  for (size_t k = 0; k < i; ++k)
+    mu_check(session_find(&table, k) == &s[k]);
+
+  hashtable_cleanup(&table);
+  free(b);
+}
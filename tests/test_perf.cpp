@@ -27,11 +27,18 @@ static int avl_cmp(avlnode_t const* l, avlnode_t const* r) {
   return lp->age - rp->age;
 }
 
+struct person_cmp {
+  int operator()(person_avl_s const& l, person_avl_s const& r) const { return l.age - r.age; }
+};
+
+using person_ops = mitosha::avltree_ops<person_avl_s, person_cmp>;
+
 constexpr int CYCLE = 10;
 constexpr int COUNT = 50000;
 static size_t DATASIZE = 0;
 
 static void avl_perf(float&);
+static void avl_inline_perf(float&);
 static void std_perf(float&);
 static void std_perf_pool(float&);
 static void std_perf_shared(float&);
@@ -50,14 +57,16 @@ extern "C" void mu_test_perf() {
   printf("objects  : %d\n", COUNT);
   printf("operations: %d\n", COUNT * CYCLE);
 
-  float avl_tm = 1, ipc_tm = 1, std_tm = 1, stdp_tm = 1;
+  float avl_tm = 1, avli_tm = 1, ipc_tm = 1, std_tm = 1, stdp_tm = 1;
 
   avl_perf(avl_tm);
+  avl_inline_perf(avli_tm);
   std_perf_shared(ipc_tm);
   std_perf(std_tm);
   std_perf_pool(stdp_tm);
 
   printf("AVL    : %d ops/sec\n", (int) avl_tm);
+  printf("AVL INL: %d ops/sec  (%.2fx)\n", (int) avli_tm, avl_tm / avli_tm);
   printf("IPC    : %d ops/sec  (%.2fx)\n", (int) ipc_tm, avl_tm / ipc_tm);
   printf("STD    : %d ops/sec  (%.2fx)\n", (int) std_tm, avl_tm / std_tm);
   printf("STD+POOL: %d ops/sec (%.2fx)\n", (int) stdp_tm, avl_tm / stdp_tm);
@@ -115,6 +124,53 @@ void test::avl_perf(float& r) {
   mshm_cleanup(shma);
 }
 
+void test::avl_inline_perf(float& r) {
+  mshm_t* shma = mshm_create("mitosha", DATASIZE);
+  mu_ensure(shma);
+
+  void* mem = mshm_memory_ptr(shma);
+  mpool_t* pool = mpool_format_memory(mem, mshm_memory_size(shma));
+  mu_ensure(pool);
+
+  avltree_t* set = static_cast<avltree_t*>(mpool_alloc(pool, sizeof(*set)));
+  avltree_init(set);
+
+  // fill
+  for (int i = 0; i < COUNT; ++i) {
+    person_avl_s* p = static_cast<person_avl_s*>(mpool_alloc(pool, sizeof(*p)));
+    mu_check(p);
+    p->age = i;
+    p->validate = i + 1;
+    person_ops::insert(set, p);
+  }
+
+  clock_t cl = clock();
+
+  for (int j = 0; j < CYCLE; ++j) {
+    person_avl_s p;
+
+    for (p.age = 0; p.age < COUNT; ++p.age) {
+      person_avl_s* n = person_ops::lookup(set, p);
+      mu_ensure(n);
+
+      person_avl_s v = *n;
+      avltree_remove(n, set);
+      mpool_free(pool, n);
+
+      n = static_cast<person_avl_s*>(mpool_alloc(pool, sizeof(*n)));
+      *n = v;
+
+      person_ops::insert(set, n);
+      n = person_ops::lookup(set, p);
+      mu_ensure(n);
+      mu_check(n->validate == p.age + 1);
+    }
+  }
+
+  r = measure(cl, COUNT * CYCLE);
+  mshm_cleanup(shma);
+}
+
 //--------------------------------------------------------------------------
 
 #include <boost/pool/pool.hpp>
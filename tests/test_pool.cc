@@ -1,4 +1,5 @@
 #include <mutest.h>
+#include <errno.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
@@ -66,6 +67,17 @@ extern "C" void mu_test_pool_open() {
 
   size_t const stuff = mpool_size_stuff(sz);
   mu_check(mpool_total_size(p) - stuff == mpool_total_capacity(p));
+
+  /* a pool of another layout version is rejected */
+  size_t marker;
+  memcpy(&marker, b, sizeof(marker));
+  size_t const other = marker ^ 1;
+  memcpy(b, &other, sizeof(other));
+  errno = 0;
+  mu_check(!mpool_attach_existing(b));
+  mu_check(EPROTO == errno);
+  memcpy(b, &marker, sizeof(marker));
+  mu_check(mpool_attach_existing(b));
 }
 
 extern "C" void mu_test_pool_balance() {
@@ -114,7 +126,12 @@ extern "C" void mu_test_pool_balance() {
   mu_check(111 == ((uint8_t*) r1)[0]);
 
   r2 = mpool_realloc(p, r1, 24);
-  mu_check(r2 != r1);
+  mu_check(r2 == r1);
+  mu_check(32 == mpool_used(p));
+  mu_check(111 == ((uint8_t*) r2)[0]);
+
+  // a size that wraps when aligned is no shrink
+  mu_check(!mpool_realloc(p, r2, SIZE_MAX - 4));
   mu_check(32 == mpool_used(p));
   mu_check(111 == ((uint8_t*) r2)[0]);
 
@@ -222,6 +239,538 @@ extern "C" void mu_test_pool_realloc_stress() {
   mpool_cleanup(p);
 }
 
+// size class bins: holes are reused, large blocks come back after merge
+extern "C" void mu_test_pool_bins() {
+  size_t const sz = mpool_calc_required_size(64, 256);
+  char* b = (char*) malloc(sz);
+  mu_check(b);
+
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_check(p);
+  size_t const avail = mpool_free_space(p);
+
+  void* blocks[256] = {0};
+  for (size_t i = 0; i < 256; ++i) {
+    blocks[i] = mpool_alloc(p, 1 + i % 64);
+    mu_ensure(blocks[i]);
+  }
+
+  for (size_t i = 0; i < 256; i += 2) {
+    mpool_free(p, blocks[i]);
+    blocks[i] = NULL;
+  }
+
+  for (size_t i = 0; i < 256; i += 2) {
+    blocks[i] = mpool_alloc(p, 1 + i % 64);
+    mu_check(blocks[i]);
+  }
+
+  for (size_t i = 0; i < 256; ++i)
+    mpool_free(p, blocks[i]);
+
+  mu_check(0 == mpool_used(p));
+  mu_check(avail == mpool_free_space(p));
+
+  void* all = mpool_alloc(p, mpool_total_capacity(p));
+  mu_check(all);
+  mpool_free(p, all);
+
+  mpool_cleanup(p);
+  free(b);
+}
+
+// left merge into a long free run
+extern "C" void mu_test_pool_left_merge() {
+  size_t const count = 100000;
+  size_t const sz = mpool_calc_required_size(8, count);
+  char* b = (char*) malloc(sz);
+  mu_check(b);
+
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_check(p);
+
+  void** blocks = (void**) malloc(count * sizeof(void*));
+  for (size_t i = 0; i < count; ++i) {
+    blocks[i] = mpool_alloc(p, 8);
+    mu_ensure(blocks[i]);
+  }
+  mu_check(!mpool_alloc(p, 8));
+
+  for (size_t i = 0; i < count; ++i)
+    mpool_free(p, blocks[i]);
+
+  mu_check(0 == mpool_used(p));
+  void* all = mpool_alloc(p, mpool_total_capacity(p));
+  mu_check(all);
+
+  mpool_cleanup(p);
+  free(blocks);
+  free(b);
+}
+
+extern "C" void mu_test_pool_stats() {
+  size_t const sz = mpool_calc_required_size(32, 10);
+  char b[sz];
+  mpool_t* p = mpool_format_memory(b, sizeof(b));
+  mu_check(p);
+
+  mpool_stats_t st;
+  mpool_stats(p, &st);
+  mu_check(st.total_size == sizeof(b));
+  mu_check(st.capacity == mpool_total_capacity(p));
+  mu_check(st.used == 0);
+  mu_check(st.free == mpool_total_capacity(p));
+  mu_check(st.free_blocks == 1);
+  mu_check(st.largest_free == st.free);
+
+  void* v[10];
+  for (size_t i = 0; i < 10; ++i)
+    v[i] = mpool_alloc(p, 32);
+
+  mpool_stats(p, &st);
+  mu_check(st.used == 10 * 48);
+  mu_check(st.free_blocks == 0);
+  mu_check(st.largest_free == 0);
+
+  mpool_free(p, v[1]);
+  mpool_free(p, v[5]);
+  mpool_free(p, v[6]);
+
+  mpool_stats(p, &st);
+  mu_check(st.free_blocks == 2);
+  mu_check(st.largest_free == 2 * 48 - sizeof(size_t));
+  mu_check(st.free == mpool_free_space(p));
+  mu_check(st.free == 3 * 48 - 2 * sizeof(size_t));
+
+  void* big = mpool_alloc(p, st.largest_free);
+  mu_check(big == v[5]);
+
+  mpool_stats(p, &st);
+  mu_check(st.free_blocks == 1);
+  mu_check(st.largest_free == 48 - sizeof(size_t));
+
+  mpool_cleanup(p);
+}
+
+// the largest size is found again after its last block is taken, then served from the cache
+extern "C" void mu_test_pool_largest_taken() {
+  size_t const sz = mpool_calc_required_size(256, 16);
+  char* b = (char*) malloc(sz);
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  void* v[8];
+  for (size_t i = 0; i < 8; ++i)
+    v[i] = mpool_alloc(p, 40 + 16 * (i / 2));
+  while (mpool_alloc(p, 8))
+    ;
+  for (size_t i = 0; i < 8; i += 2)
+    mpool_free(p, v[i]);
+
+  mpool_stats_t st;
+  mpool_stats(p, &st);
+  mu_check(st.free_blocks == 4 && st.largest_free == 88);
+  mu_check(mpool_alloc(p, 88) == v[6]);
+  for (int k = 0; k < 3; ++k) {
+    mpool_stats(p, &st);
+    mu_check(st.free_blocks == 3 && st.largest_free == 72);
+  }
+  mpool_free(p, v[6]);
+  mpool_stats(p, &st);
+  mu_check(st.largest_free == 88);
+
+  free(b);
+}
+
+// taking equal holes keeps largest_free exact (refreshed lazily, not per alloc)
+extern "C" void mu_test_pool_largest_equal_holes() {
+  size_t const count = 20000;
+  size_t const sz = mpool_calc_required_size(32, count);
+  char* b = (char*) malloc(sz);
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  void** blocks = (void**) malloc(count * sizeof(void*));
+  for (size_t i = 0; i < count; ++i)
+    blocks[i] = mpool_alloc(p, 32);
+  for (size_t i = 0; i < count; i += 2)
+    mpool_free(p, blocks[i]);
+
+  mpool_stats_t st;
+  for (size_t i = 0; i < count / 2; ++i) {
+    if (i % 1000 == 0) {
+      mpool_stats(p, &st);
+      mu_check(st.largest_free == 40);
+    }
+    mu_ensure(mpool_alloc(p, 32));
+  }
+  mpool_stats(p, &st);
+  mu_check(st.largest_free == 0 && st.free_blocks == 0);
+
+  mpool_free(p, blocks[1]);
+  mpool_stats(p, &st);
+  mu_check(st.largest_free == 40);
+
+  free(blocks);
+  free(b);
+}
+
+extern "C" void mu_test_pool_histogram() {
+  size_t const sz = mpool_calc_required_size(32, 10);
+  char b[sz];
+  mpool_t* p = mpool_format_memory(b, sizeof(b));
+  mu_check(p);
+
+  void* v[10];
+  for (size_t i = 0; i < 10; ++i)
+    v[i] = mpool_alloc(p, 32);
+  mpool_free(p, v[1]);
+  mpool_free(p, v[5]);
+  mpool_free(p, v[6]);
+
+  size_t pos = 0, n = 0, total = 0;
+  mpool_block_t block;
+  while (mpool_next_block(p, &pos, &block)) {
+    mu_check(block.used == (block.ptr != v[1] && block.ptr != v[5]));
+    total += block.size + sizeof(size_t);
+    ++n;
+  }
+  mu_check(n == 9);
+  mu_check(total == mpool_total_capacity(p) + sizeof(size_t));
+
+  mpool_histogram_t h;
+  mu_check(mpool_histogram(p, &h) == 0);
+  mu_check(h.used_blocks == 7 && h.free_blocks == 2);
+  mu_check(h.used_count[5] == 7 && h.used_bytes[5] == 7 * 40);
+  mu_check(h.free_count[5] == 1 && h.free_count[6] == 1);
+  mu_check(h.free == mpool_free_space(p));
+  mu_check(h.largest_free == 88);
+  mu_check(h.fragmentation > 0.31 && h.fragmentation < 0.32);
+
+  /* a private copy gives the same answer */
+  char* copy = (char*) malloc(sizeof(b));
+  memcpy(copy, b, sizeof(b));
+  mpool_histogram_t hc;
+  mu_check(mpool_histogram((mpool_t*) copy, &hc) == 0);
+  mu_check(!memcmp(hc.free_count, h.free_count, sizeof(h.free_count)) && hc.largest_free == h.largest_free);
+  free(copy);
+
+  for (size_t i = 0; i < 10; ++i) {
+    if (i != 1 && i != 5 && i != 6)
+      mpool_free(p, v[i]);
+  }
+  mu_check(mpool_histogram(p, &h) == 0);
+  mu_check(h.free_blocks == 1 && h.used_blocks == 0 && h.fragmentation == 0.0);
+
+  mpool_cleanup(p);
+}
+
+extern "C" void mu_test_pool_counters() {
+  size_t const sz = mpool_calc_required_size(32, 10);
+  char b[sz];
+  mpool_t* p = mpool_format_memory(b, sizeof(b));
+  mu_check(p);
+
+  void* v[10];
+  for (size_t i = 0; i < 10; ++i)
+    v[i] = mpool_alloc(p, 32);
+  mu_check(!mpool_alloc(p, 32));
+  mpool_free(p, v[4]);
+  mpool_free(p, v[6]);
+  mpool_free(p, v[5]);
+
+  mpool_counters_t c;
+  if (mpool_counters(p, &c)) {
+    mu_check(c.allocs == 0 && c.frees == 0 && c.searches == 0);
+    mpool_cleanup(p);
+    return;
+  }
+  mu_check(c.allocs == 11);
+  mu_check(c.alloc_failed == 1);
+  mu_check(c.frees == 3);
+  mu_check(c.searches == 11);
+  mu_check(c.search_probes >= 10);
+  mu_check(c.search_max >= 1);
+  mu_check(c.merges_left == 1);
+  mu_check(c.merges_right == 1);
+  mu_check(c.scans >= 1);
+  mu_check(c.scan_words >= c.scans);
+
+  mpool_counters_reset(p);
+  mpool_counters(p, &c);
+  mu_check(c.allocs == 0 && c.frees == 0 && c.scan_max == 0);
+
+  mpool_cleanup(p);
+}
+
+// realloc grows in place when the right neighbour is free
+extern "C" void mu_test_pool_realloc_grow() {
+  size_t const sz = mpool_calc_required_size(64, 8);
+  char b[sz];
+  mpool_t* p = mpool_format_memory(b, sizeof(b));
+  mu_check(p);
+
+  char* a = (char*) mpool_alloc(p, 24);
+  void* n = mpool_alloc(p, 64);
+  void* c = mpool_alloc(p, 8);
+  mu_ensure(a && n && c);
+  memset(a, 7, 24);
+
+  mpool_free(p, n);
+  size_t const used = mpool_used(p);
+
+  char* g = (char*) mpool_realloc(p, a, 48);
+  mu_check(g == a);
+  mu_check(used + 32 == mpool_used(p));
+  mu_check(7 == g[0] && 7 == g[23]);
+
+  g = (char*) mpool_realloc(p, a, 24 + 80);
+  mu_check(g == a);
+  mu_check(mpool_block_size(g) >= 24 + 80);
+
+  g = (char*) mpool_realloc(p, a, 24 + 96);
+  mu_check(g && g != a);
+  mu_check(7 == g[0] && 7 == g[23]);
+
+  mpool_free(p, g);
+  mpool_free(p, c);
+  mu_check(0 == mpool_used(p));
+  mpool_cleanup(p);
+}
+
+extern "C" void mu_test_pool_extend() {
+  size_t const sz = mpool_calc_required_size(64, 16);
+  size_t const big = mpool_calc_required_size(64, 256);
+  char* mem = (char*) malloc(big);
+  mpool_t* p = mpool_format_memory(mem, sz);
+  mu_ensure(p);
+
+  void* blocks[256] = {};
+  size_t n = 0;
+  while ((blocks[n] = mpool_alloc(p, 64)))
+    memset(blocks[n++], 0x33, 64);
+  mu_check(n > 0 && n < 256);
+  size_t const used = mpool_used(p);
+  size_t const cap = mpool_total_capacity(p);
+
+  mu_check(mpool_extend(p, sz - 1));
+  mu_check(mpool_extend(p, (size_t) 1 << 40));
+  mu_check(mpool_total_size(p) == sz && mpool_total_capacity(p) == cap);
+  mu_check(!mpool_format_memory(mem, (size_t) 1 << 40));
+  mu_check(0 == mpool_extend(p, big));
+  mu_check(mpool_total_size(p) == big);
+  mu_check(mpool_total_capacity(p) > cap);
+  mu_check(mpool_used(p) == used);
+
+  while (n < 256 && (blocks[n] = mpool_alloc(p, 64)))
+    memset(blocks[n++], 0x33, 64);
+  mu_check(n == 256);
+
+  for (size_t i = 0; i < n; ++i) {
+    mu_check(((char*) blocks[i])[0] == 0x33 && ((char*) blocks[i])[63] == 0x33);
+    mpool_free(p, blocks[i]);
+  }
+  mu_check(0 == mpool_used(p));
+  mu_check(mpool_alloc(p, mpool_total_capacity(p)));
+
+  free(mem);
+}
+
+// compaction keeps avltree/list links and payload of moved objects
+struct compact_obj_t {
+  avlnode_t anode;
+  listnode_t lnode;
+  uint64_t key;
+  size_t nfill;
+  unsigned char fill[];
+};
+
+struct compact_ctx_t {
+  avltree_t tree;
+  list_t list;
+  size_t moves;
+};
+
+static int compact_cmp(avlnode_t const* l, avlnode_t const* r) {
+  uint64_t const a = mcontainer_of(l, compact_obj_t, anode)->key;
+  uint64_t const b = mcontainer_of(r, compact_obj_t, anode)->key;
+  return (a > b) - (a < b);
+}
+
+static int compact_relocate(void* ptr, void const* old, size_t, void* arg) {
+  if (!ptr)
+    return 0;
+  compact_ctx_t* ctx = (compact_ctx_t*) arg;
+  compact_obj_t* obj = (compact_obj_t*) ptr;
+  compact_obj_t const* prev = (compact_obj_t const*) old;
+  avltree_relocate(&obj->anode, &prev->anode, &ctx->tree);
+  list_relocate(&obj->lnode, &prev->lnode, &ctx->list);
+  ++ctx->moves;
+  return 0;
+}
+
+extern "C" void mu_test_pool_compact() {
+  size_t const count = 300;
+  size_t const sz = mpool_calc_required_size(sizeof(compact_obj_t) + 128, count);
+  char* mem = (char*) malloc(sz);
+  mpool_t* p = mpool_format_memory(mem, sz);
+  mu_ensure(p);
+
+  compact_ctx_t ctx;
+  avltree_init(&ctx.tree);
+  list_init(&ctx.list);
+  ctx.moves = 0;
+
+  compact_obj_t* objs[count];
+  for (size_t i = 0; i < count; ++i) {
+    size_t const fill = (i * 37) % 128;
+    objs[i] = (compact_obj_t*) mpool_alloc(p, sizeof(compact_obj_t) + fill);
+    mu_ensure(objs[i]);
+    objs[i]->key = (i * 7919) % count;
+    objs[i]->nfill = fill;
+    memset(objs[i]->fill, (int) (objs[i]->key & 0xff), fill);
+    avltree_insert(&objs[i]->anode, compact_cmp, &ctx.tree);
+    list_push_back(&objs[i]->lnode, &ctx.list);
+  }
+  for (size_t i = 0; i < count; i += 3) {
+    avltree_remove(&objs[i]->anode, &ctx.tree);
+    list_remove(&objs[i]->lnode, &ctx.list);
+    mpool_free(p, objs[i]);
+  }
+
+  mpool_histogram_t h;
+  mpool_histogram(p, &h);
+  mu_check(h.free_blocks > 1);
+  size_t const used = mpool_used(p);
+
+  size_t cursor = 0, calls = 1;
+  while (mpool_compact(p, &cursor, 512, compact_relocate, &ctx))
+    ++calls;
+  mu_check(calls > 1);
+  mu_check(ctx.moves > 0);
+  mu_check(used == mpool_used(p));
+
+  mpool_histogram(p, &h);
+  mu_check(h.free_blocks == 1);
+  mu_check(h.largest_free == h.free);
+  mu_check(h.fragmentation == 0.0);
+
+  size_t n = 0;
+  uint64_t last = 0;
+  for (avlnode_t* node = avltree_first(&ctx.tree); node; node = avltree_next(node), ++n) {
+    compact_obj_t const* obj = mcontainer_of(node, compact_obj_t, anode);
+    mu_check(!n || obj->key > last);
+    last = obj->key;
+    for (size_t j = 0; j < obj->nfill; ++j)
+      mu_ensure(obj->fill[j] == (obj->key & 0xff));
+  }
+  mu_check(n == count - count / 3);
+
+  size_t i = 1;
+  for (listnode_t* node = list_front(&ctx.list); node; node = list_next(node), i += (i % 3 == 2) ? 2 : 1) {
+    compact_obj_t const* obj = mcontainer_of(node, compact_obj_t, lnode);
+    mu_check(obj->key == (i * 7919) % count);
+  }
+  mu_check(i == count + 1);
+
+  /* a second pass finds nothing to move */
+  cursor = 0;
+  ctx.moves = 0;
+  mu_check(!mpool_compact(p, &cursor, 0, compact_relocate, &ctx));
+  mu_check(!ctx.moves);
+
+  free(mem);
+}
+
+// compaction of a pool behind an mcache: magazines flushed first, pinned blocks stay put
+struct pinned_ctx_t {
+  unsigned char* ptrs[240];
+  size_t moves;
+};
+
+static size_t pinned_request(size_t idx) {
+  return 16 + (idx % 4) * 16;
+}
+
+static int pinned_relocate(void* ptr, void const* old, size_t, void* arg) {
+  pinned_ctx_t* ctx = (pinned_ctx_t*) arg;
+  size_t idx;
+  memcpy(&idx, ptr ? ptr : old, sizeof(idx));
+  if (!ptr)
+    return idx % 5 == 0;
+  ctx->ptrs[idx] = (unsigned char*) ptr;
+  ++ctx->moves;
+  return 0;
+}
+
+static void pinned_verify(pinned_ctx_t const* ctx, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!ctx->ptrs[i])
+      continue;
+    size_t idx;
+    memcpy(&idx, ctx->ptrs[i], sizeof(idx));
+    mu_ensure(idx == i);
+    for (size_t j = sizeof(size_t); j < pinned_request(i); ++j)
+      mu_ensure(ctx->ptrs[i][j] == (unsigned char) i);
+  }
+}
+
+extern "C" void mu_test_pool_compact_cache() {
+  size_t const count = 240;
+  size_t const sz = mpool_calc_required_size(64, 2 * count);
+  char* mem = (char*) malloc(sz);
+  mpool_t* p = mpool_format_memory(mem, sz);
+  mu_ensure(p);
+  mcache_t* c = mcache_create(p, NULL);
+  mu_ensure(c);
+
+  pinned_ctx_t ctx = {};
+  for (size_t i = 0; i < count; ++i) {
+    ctx.ptrs[i] = (unsigned char*) mcache_alloc(c, pinned_request(i));
+    mu_ensure(ctx.ptrs[i]);
+    memcpy(ctx.ptrs[i], &i, sizeof(i));
+    memset(ctx.ptrs[i] + sizeof(i), (int) (i & 0xff), pinned_request(i) - sizeof(i));
+  }
+  /* freed blocks stay parked in the magazines until the flush */
+  for (size_t i = 1; i < count; i += 3) {
+    mcache_free(c, ctx.ptrs[i]);
+    ctx.ptrs[i] = NULL;
+  }
+  mu_check(0 == mcache_flush(c));
+  size_t const used = mpool_used(p);
+
+  unsigned char* pinned[count] = {};
+  size_t npinned = 0;
+  for (size_t i = 0; i < count; i += 5) {
+    pinned[i] = ctx.ptrs[i];
+    npinned += ctx.ptrs[i] != NULL;
+  }
+
+  size_t cursor = 0;
+  while (mpool_compact(p, &cursor, 256, pinned_relocate, &ctx))
+    ;
+  mu_check(ctx.moves > 0);
+  mu_check(used == mpool_used(p));
+  for (size_t i = 0; i < count; i += 5)
+    mu_check(ctx.ptrs[i] == pinned[i]);
+  pinned_verify(&ctx, count);
+
+  mpool_histogram_t h;
+  mu_check(0 == mpool_histogram(p, &h));
+  mu_check(h.free_blocks <= npinned + 1);
+
+  /* the cache hands out only truly free blocks afterwards */
+  for (size_t i = 0; i < 100; ++i) {
+    void* ptr = mcache_alloc(c, pinned_request(i));
+    mu_ensure(ptr);
+    memset(ptr, 0xee, mpool_block_size(ptr));
+  }
+  pinned_verify(&ctx, count);
+
+  mcache_cleanup(c);
+  free(mem);
+}
+
 // performance test
 inline float measure(size_t count, clock_t cl) {
   return (float) count / ((float) (clock() - cl) / CLOCKS_PER_SEC);
@@ -0,0 +1,176 @@
+#include <mutest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <mitosha.h>
+
+void mu_test_ring_spsc() {
+  size_t const sz = mring_calc_required_size(16, sizeof(int), MRING_SPSC);
+  char* b = malloc(sz + 100);
+  mu_check(!mring_format(b, 10, sizeof(int), MRING_SPSC));
+
+  mring_t* r = mring_format(b, sz + 100, sizeof(int), MRING_SPSC);
+  mu_ensure(r);
+  mu_check(r == mring_attach_existing(b));
+  mu_check(16 == mring_capacity(r));
+  mu_check(sizeof(int) == mring_elem_size(r));
+
+  int in[40], out[40];
+  for (int i = 0; i < 40; ++i)
+    in[i] = i;
+
+  mu_check(0 == mring_dequeue(r, out, 1));
+  mu_check(10 == mring_enqueue(r, in, 10));
+  mu_check(6 == mring_enqueue(r, in + 10, 10));
+  mu_check(0 == mring_enqueue(r, in, 1));
+  mu_check(16 == mring_count(r));
+
+  /* batches wrap around the end of the slots */
+  for (int round = 0; round < 5; ++round) {
+    mu_check(12 == mring_dequeue(r, out, 12));
+    for (int i = 0; i < 12; ++i)
+      mu_check(out[i] == (round * 12 + i) % 40);
+    mu_check(4 == mring_count(r));
+    mu_check(12 == mring_enqueue(r, in + (round * 12 + 16) % 40, 12));
+  }
+  free(b);
+}
+
+void mu_test_ring_odd_size() {
+  typedef struct {
+    char s[13];
+  } msg_t;
+  size_t const sz = mring_calc_required_size(8, sizeof(msg_t), MRING_SPSC);
+  char* b = malloc(sz);
+  mring_t* r = mring_format(b, sz, sizeof(msg_t), MRING_SPSC);
+  mu_ensure(r);
+  mu_check(8 == mring_capacity(r));
+
+  msg_t m[8], o[8];
+  for (int i = 0; i < 8; ++i)
+    memset(m[i].s, 'a' + i, sizeof(m[i].s));
+  mu_check(5 == mring_enqueue(r, m, 5));
+  mu_check(3 == mring_dequeue(r, o, 3));
+  mu_check(6 == mring_enqueue(r, m, 8));
+  mu_check(8 == mring_dequeue(r, o, 8));
+  mu_check(!memcmp(o, m + 3, 2 * sizeof(msg_t)));
+  mu_check(!memcmp(o + 2, m, 6 * sizeof(msg_t)));
+  free(b);
+}
+
+void mu_test_ring_timeout() {
+  size_t const sz = mring_calc_required_size(4, sizeof(long), MRING_MPMC);
+  char* b = malloc(sz);
+  mring_t* r = mring_format(b, sz, sizeof(long), MRING_MPMC);
+  mu_ensure(r);
+
+  long v[4] = {1, 2, 3, 4};
+  mu_check(0 == mring_dequeue_wait(r, v, 1, 10));
+  mu_check(4 == mring_enqueue_wait(r, v, 4, 10));
+  mu_check(0 == mring_enqueue_wait(r, v, 1, 10));
+  mu_check(2 == mring_dequeue_wait(r, v, 2, -1));
+  mu_check(v[0] == 1 && v[1] == 2);
+  free(b);
+}
+
+#define RING_THREADS 4
+#define RING_ITEMS 100000
+
+static mring_t* ring_shared;
+static long ring_sums[RING_THREADS];
+static long ring_done;
+
+static void* ring_producer(void* arg) {
+  long const id = (long) arg;
+  for (long i = 0; i < RING_ITEMS;) {
+    long batch[4];
+    size_t n = 0;
+    for (; n < 4 && i + (long) n < RING_ITEMS; ++n)
+      batch[n] = id * RING_ITEMS + i + (long) n + 1;
+    for (size_t k = 0; k < n;)
+      k += mring_enqueue_wait(ring_shared, batch + k, n - k, -1);
+    i += (long) n;
+  }
+  return NULL;
+}
+
+static void* ring_consumer(void* arg) {
+  long const id = (long) arg;
+  long const total = (long) RING_THREADS * RING_ITEMS;
+  while (__atomic_load_n(&ring_done, __ATOMIC_RELAXED) < total) {
+    long v[3];
+    size_t const n = mring_dequeue_wait(ring_shared, v, 3, 10);
+    for (size_t k = 0; k < n; ++k)
+      ring_sums[id] += v[k];
+    __atomic_add_fetch(&ring_done, (long) n, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+void mu_test_ring_mpmc_threads() {
+  size_t const sz = mring_calc_required_size(64, sizeof(long), MRING_MPMC);
+  char* b = malloc(sz);
+  ring_shared = mring_format(b, sz, sizeof(long), MRING_MPMC);
+  mu_ensure(ring_shared);
+
+  pthread_t prod[RING_THREADS], cons[RING_THREADS];
+  ring_done = 0;
+  for (long i = 0; i < RING_THREADS; ++i) {
+    ring_sums[i] = 0;
+    pthread_create(&cons[i], NULL, ring_consumer, (void*) i);
+    pthread_create(&prod[i], NULL, ring_producer, (void*) i);
+  }
+  for (int i = 0; i < RING_THREADS; ++i)
+    pthread_join(prod[i], NULL);
+  for (int i = 0; i < RING_THREADS; ++i)
+    pthread_join(cons[i], NULL);
+
+  long sum = 0;
+  for (int i = 0; i < RING_THREADS; ++i)
+    sum += ring_sums[i];
+  long const n = (long) RING_THREADS * RING_ITEMS;
+  mu_check(sum == n * (n + 1) / 2);
+  mu_check(0 == mring_count(ring_shared));
+  free(b);
+}
+
+void mu_test_ring_fork() {
+  mshm_unlink("mitosha_ring");
+  mshm_t* m = mshm_create("mitosha_ring", mring_calc_required_size(32, sizeof(int), MRING_SPSC));
+  mu_ensure(m);
+  mring_t* r = mring_format(mshm_memory_ptr(m), mshm_memory_size(m), sizeof(int), MRING_SPSC);
+  mu_ensure(r);
+
+  pid_t pid = fork();
+  mu_ensure(pid >= 0);
+  if (!pid) {
+    mshm_t* c = mshm_open("mitosha_ring");
+    mring_t* cr = c ? mring_attach_existing(mshm_memory_ptr(c)) : NULL;
+    if (!cr)
+      _exit(1);
+    for (int i = 0; i < 10000; ++i)
+      while (!mring_enqueue_wait(cr, &i, 1, 1000))
+        ;
+    _exit(0);
+  }
+
+  long sum = 0;
+  int v[8];
+  for (int n = 0; n < 10000;) {
+    size_t const k = mring_dequeue_wait(r, v, 8, 5000);
+    mu_ensure(k);
+    for (size_t i = 0; i < k; ++i)
+      mu_check(v[i] == n + (int) i);
+    n += (int) k;
+    sum += (long) k;
+  }
+  mu_check(sum == 10000);
+
+  int status = 0;
+  mu_ensure(pid == waitpid(pid, &status, 0));
+  mu_check(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+  mshm_cleanup(m);
+  mshm_unlink("mitosha_ring");
+}
@@ -3,6 +3,10 @@
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <mitosha.h>
 
 void mu_test_shm_create() {
@@ -173,3 +177,323 @@ void mu_test_shm_reopen_after_cleanup() {
 
   mshm_cleanup(r2);
 }
+
+void mu_test_shm_mutex() {
+  mshm_unlink("mitosha_mutex");
+
+  mshm_options_t opts = {MSHM_MUTEX};
+  mshm_t* r = mshm_create_ex("mitosha_mutex", 64, &opts);
+  mu_ensure(r);
+  mu_check(mshm_memory_size(r) == 64);
+
+  mshm_t* r2 = mshm_open("mitosha_mutex");
+  mu_ensure(r2);
+
+  mu_check(0 == mshm_lock(r));
+  mu_check(mshm_trylock(r2));
+  mu_check(0 == mshm_unlock(r));
+  mu_check(0 == mshm_trylock(r2));
+  mu_check(0 == mshm_unlock_force(r2));
+  mu_check(0 == mshm_trylock(r));
+  mu_check(0 == mshm_unlock(r));
+
+  mshm_cleanup(r2);
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_mutex");
+}
+
+void mu_test_shm_mutex_owner_dead() {
+  mshm_unlink("mitosha_mutex");
+
+  mshm_options_t opts = {MSHM_MUTEX};
+  mshm_t* r = mshm_create_ex("mitosha_mutex", 64, &opts);
+  mu_ensure(r);
+
+  pid_t pid = fork();
+  mu_ensure(pid >= 0);
+  if (!pid) {
+    mshm_t* c = mshm_open("mitosha_mutex");
+    if (!c || mshm_lock(c))
+      _exit(1);
+    strcpy(mshm_memory_ptr(c), "owner");
+    _exit(0);
+  }
+
+  int status = 0;
+  mu_ensure(pid == waitpid(pid, &status, 0));
+  mu_check(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+  mu_check(EOWNERDEAD == mshm_lock(r));
+  mu_check(0 == strcmp(mshm_memory_ptr(r), "owner"));
+  mu_check(0 == mshm_unlock(r));
+
+  mu_check(0 == mshm_trylock(r));
+  mu_check(0 == mshm_unlock(r));
+
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_mutex");
+}
+
+void mu_test_shm_create_race() {
+  mshm_unlink("mitosha_race");
+
+  /* concurrent creators must not re-initialise a mutex another one holds */
+  enum { NPROC = 8, LOOPS = 2000 };
+  pid_t pids[NPROC];
+  for (int i = 0; i < NPROC; ++i) {
+    pids[i] = fork();
+    mu_ensure(pids[i] >= 0);
+    if (!pids[i]) {
+      mshm_options_t opts = {MSHM_MUTEX};
+      mshm_t* c = mshm_create_ex("mitosha_race", 64, &opts);
+      if (!c)
+        _exit(1);
+      for (int k = 0; k < LOOPS; ++k) {
+        if (mshm_lock(c))
+          _exit(2);
+        int* counter = mshm_memory_ptr(c);
+        *counter = *counter + 1;
+        if (mshm_unlock(c))
+          _exit(3);
+      }
+      mshm_cleanup(c);
+      _exit(0);
+    }
+  }
+  for (int i = 0; i < NPROC; ++i) {
+    int status = 0;
+    mu_ensure(pids[i] == waitpid(pids[i], &status, 0));
+    mu_check(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+  }
+
+  mshm_t* r = mshm_open("mitosha_race");
+  mu_ensure(r);
+  mu_check(*(int*) mshm_memory_ptr(r) == NPROC * LOOPS);
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_race");
+}
+
+void mu_test_shm_rwlock() {
+  mshm_unlink("mitosha_rw");
+
+  mshm_t* r = mshm_create("mitosha_rw", 64);
+  mu_ensure(r);
+  mshm_t* r2 = mshm_open("mitosha_rw");
+  mu_ensure(r2);
+
+  mu_check(0 == mshm_rdlock(r));
+  mu_check(0 == mshm_tryrdlock(r2));
+  mu_check(mshm_trywrlock(r2));
+  mu_check(0 == mshm_rwunlock(r2));
+  mu_check(0 == mshm_rwunlock(r));
+
+  mu_check(0 == mshm_wrlock(r));
+  mu_check(mshm_tryrdlock(r2));
+  mu_check(mshm_trywrlock(r2));
+  mu_check(0 == mshm_rwunlock(r));
+
+  /* rw lock and segment lock are independent */
+  mu_check(0 == mshm_wrlock(r2));
+  mu_check(0 == mshm_trylock(r));
+  mu_check(0 == mshm_unlock(r));
+  mu_check(0 == mshm_rwunlock(r2));
+
+  mshm_cleanup(r2);
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_rw");
+}
+
+void mu_test_shm_rwlock_fork() {
+  mshm_unlink("mitosha_rw");
+
+  mshm_t* r = mshm_create("mitosha_rw", 64);
+  mu_ensure(r);
+
+  mu_check(0 == mshm_rdlock(r));
+
+  pid_t pid = fork();
+  mu_ensure(pid >= 0);
+  if (!pid) {
+    mshm_t* c = mshm_open("mitosha_rw");
+    /* readers share the lock across processes */
+    if (!c || mshm_tryrdlock(c) || mshm_rwunlock(c))
+      _exit(1);
+    if (!mshm_trywrlock(c))
+      _exit(2);
+    _exit(0);
+  }
+
+  int status = 0;
+  mu_ensure(pid == waitpid(pid, &status, 0));
+  mu_check(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+  mu_check(0 == mshm_rwunlock(r));
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_rw");
+}
+
+void mu_test_shm_pages() {
+  mshm_unlink("mitosha_pages");
+
+  /* huge pages fall back when the host has none reserved */
+  mshm_options_t opts = {MSHM_HUGETLB | MSHM_POPULATE, MSHM_NUMA_PREFERRED, 1};
+  mshm_t* r = mshm_create_ex("mitosha_pages", 1 << 20, &opts);
+  mu_ensure(r);
+  mu_check(mshm_memory_size(r) >= 1 << 20);
+
+  char* mem = mshm_memory_ptr(r);
+  memset(mem, 0x5a, 1 << 20);
+
+  mshm_t* r2 = mshm_open("mitosha_pages");
+  mu_ensure(r2);
+  mu_check(mshm_memory_size(r2) == mshm_memory_size(r));
+  char* mem2 = mshm_memory_ptr(r2);
+  mu_check(mem2[0] == 0x5a && mem2[(1 << 20) - 1] == 0x5a);
+
+  /* the grown tail gets the policy of the segment */
+  mu_check(0 == mshm_resize(r, 2 << 20));
+  int mode = -1;
+  char* tail = (char*) mshm_memory_ptr(r) + (3 << 19);
+  if (!syscall(SYS_get_mempolicy, &mode, NULL, 0, tail, 2 /* MPOL_F_ADDR */))
+    mu_check(mode == MSHM_NUMA_PREFERRED);
+
+  mshm_cleanup(r2);
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_pages");
+  mu_check(!mshm_open("mitosha_pages"));
+}
+
+void mu_test_shm_resize() {
+  mshm_unlink("mitosha_resize");
+
+  size_t const sz = mpool_calc_required_size(64, 16);
+  size_t const big = mpool_calc_required_size(64, 4096);
+  mshm_t* r = mshm_create("mitosha_resize", sz);
+  mu_ensure(r);
+  mpool_t* p = mpool_format_memory(mshm_memory_ptr(r), sz);
+  mu_ensure(p);
+  char* s = mpool_alloc(p, 64);
+  mu_ensure(s);
+  strcpy(s, "grow");
+  size_t const off = s - (char*) mshm_memory_ptr(r);
+  while (mpool_alloc(p, 64))
+    ;
+
+  mshm_t* r2 = mshm_open("mitosha_resize");
+  mu_ensure(r2);
+  mu_check(0 == mshm_refresh(r2));
+
+  mu_check(mshm_resize(r, sz - 1));
+  mu_check(0 == mshm_lock(r));
+  mu_check(0 == mshm_resize(r, big));
+  p = mpool_attach_existing(mshm_memory_ptr(r));
+  mu_ensure(p);
+  mu_check(0 == mpool_extend(p, big));
+  mu_check(mpool_alloc(p, 64 * 1024));
+  mu_check(0 == mshm_unlock(r));
+  mu_check(mshm_memory_size(r) == big);
+
+  mu_check(0 == mshm_refresh(r2));
+  mpool_t* p2 = mpool_attach_existing(mshm_memory_ptr(r2));
+  mu_ensure(p2);
+  mu_check(mpool_total_size(p2) == big);
+  mu_check(mpool_used(p2) == mpool_used(p));
+  mu_check(!strcmp((char*) mshm_memory_ptr(r2) + off, "grow"));
+  ((char*) mshm_memory_ptr(r2))[big - 1] = 1;
+
+  mshm_cleanup(r2);
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_resize");
+}
+
+void mu_test_shm_header() {
+  mshm_unlink("mitosha_header");
+
+  mshm_t* r = mshm_create("mitosha_header", 256);
+  mu_ensure(r);
+  mshm_t* r2 = mshm_open("mitosha_header");
+  mu_ensure(r2);
+  uint64_t const gen = mshm_generation(r);
+  mu_check(mshm_memory_size(r2) == 256 && mshm_mapped_size(r2) == 256);
+
+  mu_check(0 == mshm_resize(r, 4096));
+  mu_check(mshm_generation(r2) != gen);
+  mu_check(mshm_memory_size(r2) == 4096 && mshm_mapped_size(r2) == 256);
+  mu_check(0 == mshm_refresh(r2));
+  mu_check(mshm_mapped_size(r2) == 4096);
+
+  /* a stale handle cannot shrink a segment grown elsewhere */
+  mu_check(0 == mshm_resize(r, 8192));
+  mu_check(mshm_resize(r2, 6144));
+  mu_check(errno == EINVAL);
+  mu_check(mshm_memory_size(r) == 8192 && mshm_mapped_size(r2) == 8192);
+  ((char*) mshm_memory_ptr(r))[8191] = 1;
+  mu_check(0 == mshm_resize(r2, 8192));
+
+  /* re-creating with the original size keeps the grown tail */
+  mshm_t* r3 = mshm_create("mitosha_header", 256);
+  mu_ensure(r3);
+  mu_check(mshm_memory_size(r3) == 8192 && mshm_mapped_size(r3) == 8192);
+  mu_check(((char*) mshm_memory_ptr(r3))[8191] == 1);
+  mu_check(mshm_generation(r3) == mshm_generation(r));
+  mshm_cleanup(r3);
+
+  mshm_cleanup(r2);
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_header");
+
+  /* a segment not made by mshm_create is rejected */
+  int fd = shm_open("/mitosha_foreign", O_CREAT | O_RDWR, 0666);
+  mu_ensure(fd != -1);
+  mu_check(0 == ftruncate(fd, 4096));
+  mu_check(4 == write(fd, "junk", 4));
+  close(fd);
+  errno = 0;
+  mu_check(!mshm_open("mitosha_foreign"));
+  mu_check(errno == EINVAL);
+  mshm_unlink("mitosha_foreign");
+}
+
+void mu_test_shm_event() {
+  mshm_unlink("mitosha_event");
+  mshm_t* r = mshm_create("mitosha_event", 64);
+  mu_ensure(r);
+  int* flag = mshm_memory_ptr(r);
+
+  mu_check(ETIMEDOUT == mshm_wait(r, mshm_event(r), 10));
+
+  pid_t pid = fork();
+  mu_ensure(pid >= 0);
+  if (!pid) {
+    mshm_t* c = mshm_open("mitosha_event");
+    if (!c)
+      _exit(1);
+    int* f = mshm_memory_ptr(c);
+    for (;;) {
+      uint32_t const seq = mshm_event(c);
+      if (__atomic_load_n(f, __ATOMIC_ACQUIRE))
+        break;
+      if (mshm_wait(c, seq, 5000) == ETIMEDOUT)
+        _exit(2);
+    }
+    __atomic_store_n(f, 2, __ATOMIC_RELEASE);
+    mshm_notify_one(c);
+    _exit(0);
+  }
+
+  usleep(10000);
+  __atomic_store_n(flag, 1, __ATOMIC_RELEASE);
+  mshm_notify_all(r);
+  for (;;) {
+    uint32_t const seq = mshm_event(r);
+    if (__atomic_load_n(flag, __ATOMIC_ACQUIRE) == 2)
+      break;
+    mu_ensure(0 == mshm_wait(r, seq, 5000));
+  }
+
+  int status = 0;
+  mu_ensure(pid == waitpid(pid, &status, 0));
+  mu_check(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+  mshm_cleanup(r);
+  mshm_unlink("mitosha_event");
+}
@@ -0,0 +1,104 @@
+#include <mutest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mitosha.h>
+
+typedef struct {
+  avlnode_t node;
+  int age;
+} person_t;
+
+static int person_cmp(avlnode_t const* l, avlnode_t const* r) {
+  return mcontainer_of(l, person_t, node)->age - mcontainer_of(r, person_t, node)->age;
+}
+
+void mu_test_slab_alloc() {
+  size_t const sz = 1024 * 1024;
+  char* b = malloc(sz);
+  mu_ensure(b);
+
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  mslab_t* s = mslab_format(p, 3, 0);
+  mu_ensure(s);
+  mu_check(mslab_object_size(s) == sizeof(mvoid_t));
+  mu_check(mslab_attach_existing(s) == s);
+
+  char* v[1000];
+  for (size_t i = 0; i < 1000; ++i) {
+    v[i] = mslab_alloc(s);
+    mu_ensure(v[i]);
+    memset(v[i], (int) i, 3);
+  }
+  mu_check(1000 == mslab_count(s));
+  mu_check(v[1] - v[0] == sizeof(mvoid_t));
+
+  for (size_t i = 0; i < 1000; i += 2)
+    mslab_free(s, v[i]);
+  mu_check(500 == mslab_count(s));
+
+  for (size_t i = 1; i < 1000; i += 2)
+    mu_check(v[i][0] == (char) i && v[i][2] == (char) i);
+
+  size_t const used = mpool_used(p);
+  for (size_t i = 0; i < 1000; i += 2)
+    mu_check(mslab_alloc(s));
+  mu_check(used == mpool_used(p));
+
+  mslab_cleanup(s);
+  mu_check(0 == mpool_used(p));
+  free(b);
+}
+
+void mu_test_slab_exhaust() {
+  size_t const sz = mpool_calc_required_size(16 * sizeof(person_t), 1) + 64;
+  char b[sz];
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+
+  mslab_t* s = mslab_format(p, sizeof(person_t), 4);
+  mu_ensure(s);
+
+  size_t n = 0;
+  while (mslab_alloc(s))
+    ++n;
+  mu_check(n >= 4);
+  mu_check(n % 4 == 0);
+
+  mslab_cleanup(s);
+  mu_check(0 == mpool_used(p));
+}
+
+void mu_test_slab_avltree() {
+  size_t const count = 10000;
+  size_t const sz = mpool_calc_required_size(sizeof(person_t), count);
+  char* b = malloc(sz);
+  mu_ensure(b);
+
+  mpool_t* p = mpool_format_memory(b, sz);
+  mu_ensure(p);
+  mslab_t* s = mslab_format(p, sizeof(person_t), 256);
+  mu_ensure(s);
+
+  avltree_t tree;
+  avltree_init(&tree);
+  for (size_t i = 0; i < count; ++i) {
+    person_t* n = mslab_alloc(s);
+    mu_ensure(n);
+    n->age = (int) i;
+    mu_check(!avltree_insert(&n->node, person_cmp, &tree));
+  }
+
+  person_t key = {{{0}}, 0};
+  for (key.age = 0; key.age < (int) count; ++key.age) {
+    avlnode_t* n = avltree_lookup(&key.node, person_cmp, &tree);
+    mu_ensure(n);
+    avltree_remove(n, &tree);
+    mslab_free(s, mcontainer_of(n, person_t, node));
+  }
+  mu_check(0 == mslab_count(s));
+
+  mslab_cleanup(s);
+  free(b);
+}